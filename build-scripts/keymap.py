@@ -0,0 +1,163 @@
+#! /usr/bin/env python3
+# -----------------------------------------------------------------------------
+# Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+# Released under The MIT License (MIT) (see "license.md")
+# Project located at <https://github.com/benblazak/ergodox-firmware>
+# -----------------------------------------------------------------------------
+
+"""
+Read and edit the keyboard's layout while it runs, over its raw HID interface
+(see "src/lib/keymap.h" for the commands)
+
+Rows and columns are numbered as in `custom_layout` in "src/main.c".  Values
+are layout entries, as 16 bit numbers (e.g. 0x0004 for 'a').
+
+Depends on:
+- Linux (hidraw); the device node has to be readable and writable by the
+  user
+- "telemetry.py", in the same directory
+"""
+
+# -----------------------------------------------------------------------------
+
+import argparse
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from telemetry import find_device, PACKET_SIZE
+
+# -----------------------------------------------------------------------------
+
+VERSION = 1
+
+CMD_INFO = 0x10
+CMD_READ = 0x11
+CMD_WRITE = 0x12
+CMD_COMMIT = 0x13
+CMD_DISCARD = 0x14
+CMD_RESET = 0x15
+
+STATUS = ['ok', 'busy', 'full', 'bad arguments', 'unknown command']
+
+READ_MAX = 28
+WRITE_MAX = 14
+
+# -----------------------------------------------------------------------------
+
+class Keyboard():
+	def __init__(self, device):
+		self.fd = os.open(device, os.O_RDWR)
+		self.tag = 0
+
+	def command(self, cmd, args=b''):
+		"""Send a command, and return its reply (skipping telemetry)"""
+		self.tag = (self.tag + 1) & 0xFF
+		packet = bytes([VERSION, cmd, self.tag, 0]) + args
+		packet += bytes(PACKET_SIZE - len(packet))
+		os.write(self.fd, b'\0' + packet)  # no report ID
+		while True:
+			reply = os.read(self.fd, PACKET_SIZE)
+			if reply[0] == VERSION and reply[1] == cmd and reply[2] == self.tag:
+				break
+		if reply[3]:
+			sys.exit('{}: {}'.format(hex(cmd), STATUS[reply[3]]))
+		return reply
+
+	def info(self):
+		reply = self.command(CMD_INFO)
+		return dict(zip( ['layers', 'rows', 'columns', 'edits',
+		                  'staged', 'busy', 'saved', 'saved-max'],
+		                 reply[4:12] ))
+
+	def read(self, first, count):
+		values = []
+		while count:
+			n = min(count, READ_MAX)
+			reply = self.command(CMD_READ, struct.pack('<HB', first, n))
+			values += struct.unpack_from('<{}H'.format(n), reply, 8)
+			first += n
+			count -= n
+		return values
+
+	def write(self, edits):
+		for i in range(0, len(edits), WRITE_MAX):
+			chunk = edits[i:i+WRITE_MAX]
+			args = bytes([len(chunk), 0, 0, 0])
+			for cell, value in chunk:
+				args += struct.pack('<HH', cell, value)
+			self.command(CMD_WRITE, args)
+
+# -----------------------------------------------------------------------------
+
+def main():
+	arg_parser = argparse.ArgumentParser(
+			description = "Read and edit the keyboard's layout" )
+
+	arg_parser.add_argument(
+			'--device',
+			help = 'the hidraw device node (default: found by its usage page)' )
+
+	commands = arg_parser.add_subparsers(dest = 'command', required = True)
+	commands.add_parser('info')
+	read = commands.add_parser('read', help = 'print a layer')
+	read.add_argument('layer', type = int)
+	write = commands.add_parser(
+			'write',
+			help = 'set keys (only those that change are sent), and commit' )
+	write.add_argument(
+			'edits',
+			nargs = '+',
+			metavar = 'LAYER,ROW,COLUMN=VALUE' )
+	commands.add_parser('reset', help = 'go back to the layout in flash')
+
+	args = arg_parser.parse_args(sys.argv[1:])
+
+	device = args.device or find_device()
+	if not device:
+		sys.exit('no keyboard with the raw HID interface found')
+	kb = Keyboard(device)
+	info = kb.info()
+	layer_cells = info['rows'] * info['columns']
+
+	if args.command == 'info':
+		for name, value in info.items():
+			print('{}: {}'.format(name, value))
+
+	elif args.command == 'read':
+		values = kb.read(args.layer * layer_cells, layer_cells)
+		for row in range(info['rows']):
+			line = values[row*info['columns']:(row+1)*info['columns']]
+			print(' '.join('{:04x}'.format(v) for v in line))
+
+	elif args.command == 'write':
+		edits = []
+		for edit in args.edits:
+			position, value = edit.split('=')
+			layer, row, column = (int(n) for n in position.split(','))
+			cell = layer * layer_cells + row * info['columns'] + column
+			if kb.read(cell, 1)[0] != int(value, 0):
+				edits.append((cell, int(value, 0)))
+		if not edits:
+			print('nothing to change')
+			return
+		if len(edits) > info['edits']:
+			sys.exit('at most {} keys per commit'.format(info['edits']))
+		kb.command(CMD_DISCARD)
+		kb.write(edits)
+		while kb.info()['busy']:  # the last commit is still being saved
+			pass
+		kb.command(CMD_COMMIT)
+		print('{} key(s) changed'.format(len(edits)))
+
+	elif args.command == 'reset':
+		while kb.info()['busy']:
+			pass
+		kb.command(CMD_RESET)
+
+# -----------------------------------------------------------------------------
+
+if __name__ == '__main__':
+	main()
+
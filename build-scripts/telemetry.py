@@ -0,0 +1,135 @@
+#! /usr/bin/env python3
+# -----------------------------------------------------------------------------
+# Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+# Released under The MIT License (MIT) (see "license.md")
+# Project located at <https://github.com/benblazak/ergodox-firmware>
+# -----------------------------------------------------------------------------
+
+"""
+Read and print the telemetry the keyboard streams over its raw HID interface
+(see "src/lib/telemetry.h" for the packet format)
+
+Depends on:
+- Linux (hidraw); the device node has to be readable by the user
+"""
+
+# -----------------------------------------------------------------------------
+
+import argparse
+import glob
+import os
+import struct
+import sys
+
+# -----------------------------------------------------------------------------
+
+# the start of the raw HID interface's report descriptor: usage page 0xFFAB,
+# usage 0x0200 (see "src/usb_keyboard_rawhid.c")
+DESCRIPTOR_START = bytes([0x06, 0xAB, 0xFF, 0x0A, 0x00, 0x02])
+
+PACKET_SIZE = 64
+VERSION = 1
+
+EVENTS = 1
+STATS = 2
+
+STAT_NAMES = [
+	'time',
+	'scans',
+	'events',
+	'events-lost',
+	'sched-misses',
+	'reports-suppressed',
+	'reports-dropped',
+	'reports-retried',
+	'reports-waiting',
+	'intermediate-reports',
+]
+
+# stats that are levels, not totals since reset
+STAT_LEVELS = ['time', 'reports-waiting']
+
+# -----------------------------------------------------------------------------
+
+def find_device():
+	"""Return the path of the first hidraw node with the raw HID interface"""
+	for path in sorted(glob.glob('/sys/class/hidraw/hidraw*')):
+		try:
+			with open(os.path.join(path, 'device/report_descriptor'), 'rb') as f:
+				if f.read().startswith(DESCRIPTOR_START):
+					return os.path.join('/dev', os.path.basename(path))
+		except OSError:
+			pass
+	return None
+
+def print_events(packet, columns):
+	count = packet[3]
+	(time,) = struct.unpack_from('<H', packet, 4)
+	for i in range(count):
+		delta, key = packet[6+2*i], packet[7+2*i]
+		position = key & 0x7F
+		print( '{:5d} ms  {:4}  key {:3d} (row {}, col {})'.format(
+				(time + delta) & 0xFFFF,
+				'down' if key & 0x80 else 'up',
+				position, position // columns, position % columns ) )
+
+def print_stats(packet, last):
+	count = packet[3]
+	values = struct.unpack_from('<{}H'.format(count), packet, 4)
+	line = []
+	for i, value in enumerate(values):
+		name = STAT_NAMES[i] if i < len(STAT_NAMES) else 'stat-{}'.format(i)
+		if name in STAT_LEVELS or name not in last:
+			line.append('{} {}'.format(name, value))
+		else:
+			line.append('{} +{}'.format(name, (value - last[name]) & 0xFFFF))
+		last[name] = value
+	print('stats: ' + ', '.join(line))
+
+# -----------------------------------------------------------------------------
+
+def main():
+	arg_parser = argparse.ArgumentParser(
+			description = "Print the keyboard's telemetry" )
+
+	arg_parser.add_argument(
+			'--device',
+			help = 'the hidraw device node (default: found by its usage page)' )
+	arg_parser.add_argument(
+			'--columns',
+			type = int,
+			default = 14,
+			help = 'columns in the key matrix (for row and column numbers)' )
+
+	args = arg_parser.parse_args(sys.argv[1:])
+
+	device = args.device or find_device()
+	if not device:
+		sys.exit('no keyboard with the raw HID interface found')
+
+	last_stats = {}
+	last_number = None
+	with open(device, 'rb') as f:
+		while True:
+			packet = f.read(PACKET_SIZE)
+			if len(packet) < 4:
+				continue
+			if packet[0] != VERSION:
+				print('unknown protocol version {}'.format(packet[0]))
+				continue
+
+			number = packet[2]
+			if last_number is not None and number != (last_number + 1) & 0xFF:
+				print('-- missed {} packet(s)'.format((number - last_number - 1) & 0xFF))
+			last_number = number
+
+			if packet[1] == EVENTS:
+				print_events(packet, args.columns)
+			elif packet[1] == STATS:
+				print_stats(packet, last_stats)
+
+# -----------------------------------------------------------------------------
+
+if __name__ == '__main__':
+	main()
+
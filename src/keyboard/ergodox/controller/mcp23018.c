@@ -10,6 +10,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <util/twi.h>
+#include "../../../lib/debug.h"
 #include "../../../lib/twi.h"  // `TWI_FREQ` defined in "teensy-2-0.c"
 #include "../options.h"
 #include "../matrix.h"
@@ -118,6 +119,18 @@ uint8_t mcp23018_update_matrix(bool matrix[KB_ROWS][KB_COLUMNS]) {
 	//   init()
 	ret = mcp23018_init();
 
+	#if MAKEFILE_DEBUG_CONSOLE
+		// report changes only (not every scan, while unplugged)
+		static uint8_t last_ret;
+		if (ret != last_ret) {
+			if (ret)
+				debug_printf("mcp23018: twi status 0x%02x\n", ret);
+			else
+				debug_printf("mcp23018: ok\n");
+			last_ret = ret;
+		}
+	#endif
+
 	// if there was an error
 	if (ret) {
 		// clear our part of the matrix
@@ -57,21 +57,21 @@
 	#endif
 
 	#ifndef kb_layout_press_get
-		extern const void_funptr_t PROGMEM \
+		extern const kbfun_funptr_t PROGMEM \
 			_kb_layout_press[KB_LAYERS][KB_ROWS][KB_COLUMNS];
 
 		#define kb_layout_press_get(layer,row,column) \
-			( (void_funptr_t) \
+			( (kbfun_funptr_t) \
 			  pgm_read_word(&( \
 				_kb_layout_press[layer][row][column] )) )
 	#endif
 
 	#ifndef kb_layout_release_get
-		extern const void_funptr_t PROGMEM \
+		extern const kbfun_funptr_t PROGMEM \
 			_kb_layout_release[KB_LAYERS][KB_ROWS][KB_COLUMNS];
 
 		#define kb_layout_release_get(layer,row,column) \
-			( (void_funptr_t) \
+			( (kbfun_funptr_t) \
 			  pgm_read_word(&( \
 				_kb_layout_release[layer][row][column] )) )
 
@@ -26,26 +26,18 @@
 
 #define USING_WORKMAN_P // undef to use standard workman
 
-// convenience macros
-#define  LAYER         main_arg_layer
-#define  LAYER_OFFSET  main_arg_layer_offset
-#define  ROW           main_arg_row
-#define  COL           main_arg_col
-#define  IS_PRESSED    main_arg_is_pressed
-#define  WAS_PRESSED   main_arg_was_pressed
-
 // FUNCTIONS ------------------------------------------------------------------
-void kbfun_layer_pop_all(void) {
-  kbfun_layer_pop_1();
-  kbfun_layer_pop_2();
-  kbfun_layer_pop_3();
-  kbfun_layer_pop_4();
-  kbfun_layer_pop_5();
-  kbfun_layer_pop_6();
-  kbfun_layer_pop_7();
-  kbfun_layer_pop_8();
-  kbfun_layer_pop_9();
-  kbfun_layer_pop_10();
+void kbfun_layer_pop_all(key_event_t * event) {
+  kbfun_layer_pop_1(event);
+  kbfun_layer_pop_2(event);
+  kbfun_layer_pop_3(event);
+  kbfun_layer_pop_4(event);
+  kbfun_layer_pop_5(event);
+  kbfun_layer_pop_6(event);
+  kbfun_layer_pop_7(event);
+  kbfun_layer_pop_8(event);
+  kbfun_layer_pop_9(event);
+  kbfun_layer_pop_10(event);
 }
 
 
@@ -75,15 +67,15 @@ void restore_shift_state() {
  *   key release if shift is not pressed.  Generate a normal keypress or
  *   key release if shift is pressed.
  */
-void kbfun_invert_shift_press_release(void) {
-  if (IS_PRESSED) {
+void kbfun_invert_shift_press_release(key_event_t * event) {
+  if (event->pressed) {
     ++inverted_keys_pressed;
     invert_shift_state();
   }
 
-  kbfun_press_release();
+  kbfun_press_release(event);
 
-  if (!IS_PRESSED) {
+  if (!event->pressed) {
     // if this is the last key we're releasing
     if (inverted_keys_pressed == 1) {
       restore_shift_state();
@@ -104,20 +96,20 @@ void kbfun_invert_shift_press_release(void) {
  *   If inverted keys are pressed, fix the shift state back to that of the
  *   physical keys before pressing the key.
  */
-void kbfun_fix_shifted_press_release(void) {
-  uint8_t keycode = kb_layout_get(LAYER, ROW, COL);
+void kbfun_fix_shifted_press_release(key_event_t * event) {
+  uint8_t keycode = kb_layout_get(event->layer, event->row, event->col);
   switch (keycode) {
     // shift state toggles
     case KEY_LeftShift:
-      physical_lshift_pressed = IS_PRESSED;
+      physical_lshift_pressed = event->pressed;
       break;
     case KEY_RightShift:
-      physical_rshift_pressed = IS_PRESSED;
+      physical_rshift_pressed = event->pressed;
       break;
     // Keys which don't break it
     case KEY_CapsLock:
     case KEYPAD_NumLock_Clear:
-      kbfun_press_release();
+      kbfun_press_release(event);
       return;
     default:
       // If we're not just changing the modifier, we need our true shift state.
@@ -125,14 +117,14 @@ void kbfun_fix_shifted_press_release(void) {
         inverted_keys_pressed = 0;
         restore_shift_state();
       }
-      kbfun_press_release();
+      kbfun_press_release(event);
       return;
   }
   // We only get here if we pressed left or right shift
   if (inverted_keys_pressed) {
     invert_shift_state();
   } else {
-    kbfun_press_release();
+    kbfun_press_release(event);
   }
 }
 
@@ -458,7 +450,7 @@ KB_MATRIX_LAYER(
 // ----------------------------------------------------------------------------
 
 // PRESS ----------------------------------------------------------------------
-const void_funptr_t PROGMEM _kb_layout_press[KB_LAYERS][KB_ROWS][KB_COLUMNS] = {
+const kbfun_funptr_t PROGMEM _kb_layout_press[KB_LAYERS][KB_ROWS][KB_COLUMNS] = {
 // LAYER 0
 KB_MATRIX_LAYER(
   // unused
@@ -723,7 +715,7 @@ KB_MATRIX_LAYER(
 // ----------------------------------------------------------------------------
 
 // RELEASE --------------------------------------------------------------------
-const void_funptr_t PROGMEM _kb_layout_release[KB_LAYERS][KB_ROWS][KB_COLUMNS] = {
+const kbfun_funptr_t PROGMEM _kb_layout_release[KB_LAYERS][KB_ROWS][KB_COLUMNS] = {
 // LAYER 0
 KB_MATRIX_LAYER(
   // unused
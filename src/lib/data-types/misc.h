@@ -10,7 +10,39 @@
 #ifndef LIB__DATA_TYPES_h
 	#define LIB__DATA_TYPES_h
 
+	#include <stdbool.h>
+	#include <stdint.h>
+
+	// --------------------------------------------------------------------
+
 	typedef  void (*void_funptr_t)(void);
 
+	/*
+	 * A key press or release, as seen by key functions
+	 *
+	 * - 'row', 'col': the matrix position of the key
+	 * - 'layer': the layer the key is being executed on
+	 * - 'layer_offset': how far down the layer stack 'layer' was found
+	 *   (incremented by `kbfun_transparent()`)
+	 * - 'pressed': whether this is a press (true) or a release (false)
+	 * - 'trans': whether the key was reached through a transparent key
+	 * - 'time': when the key changed state, from `timer_get_ms()`
+	 *
+	 * Passed by pointer, so on the AVR a key function receives it in
+	 * r24:r25 and never has to go through fixed RAM locations to find its
+	 * arguments.
+	 */
+	typedef struct key_event {
+		uint8_t  row;
+		uint8_t  col;
+		uint8_t  layer;
+		uint8_t  layer_offset;
+		bool     pressed;
+		bool     trans;
+		uint16_t time;
+	} key_event_t;
+
+	typedef  void (*kbfun_funptr_t)(key_event_t * event);
+
 #endif
 
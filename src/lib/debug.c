@@ -0,0 +1,41 @@
+/* ----------------------------------------------------------------------------
+ * debug output : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#if MAKEFILE_DEBUG_CONSOLE
+
+#include <stdio.h>
+#include "../usb_keyboard_rawhid.h"
+#include "./debug.h"
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Queue a character; a full line is sent at the next USB frame, rather than
+ * waiting for the packet to fill
+ */
+static int put(char c, FILE * stream) {
+	usb_debug_putchar(c);
+	if (c == '\n')
+		usb_debug_flush_output();
+	return 0;
+}
+
+static FILE stream = FDEV_SETUP_STREAM(put, NULL, _FDEV_SETUP_WRITE);
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Send `stdout` (and so `debug_printf()`) to the debug interface
+ */
+void debug_init(void) {
+	stdout = &stream;
+}
+
+#endif
+
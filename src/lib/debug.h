@@ -0,0 +1,43 @@
+/* ----------------------------------------------------------------------------
+ * debug output : exports
+ *
+ * `printf()` style messages, sent over the USB debug interface (see
+ * `DEBUG_CONSOLE` in "makefile-options", and PJRC's `hid_listen` to read
+ * them).  Messages are formatted into a RAM buffer that the USB interrupt
+ * empties, so printing never waits on the host; if the buffer is full, the
+ * rest of a message is dropped (and counted, in `usb_debug_dropped`).
+ *
+ * With `DEBUG_CONSOLE` set to 0, these macros expand to nothing, so calls can
+ * be left in.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef LIB__DEBUG_h
+	#define LIB__DEBUG_h
+
+	#if MAKEFILE_DEBUG_CONSOLE
+
+		#include <stdio.h>
+		#include <avr/pgmspace.h>
+
+		// --------------------------------------------------------------------
+
+		void debug_init (void);
+
+		// the format string is kept in flash
+		#define debug_printf(format, ...) \
+			printf_P(PSTR(format), ##__VA_ARGS__)
+
+	#else
+
+		#define debug_init()               ((void)0)
+		#define debug_printf(format, ...)  ((void)0)
+
+	#endif
+
+#endif
+
@@ -0,0 +1,68 @@
+/* ----------------------------------------------------------------------------
+ * EEPROM write queue : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/eeprom.h>
+#include "./eeprom-queue.h"
+
+// ----------------------------------------------------------------------------
+
+#if (EEPROM_QUEUE_SIZE & (EEPROM_QUEUE_SIZE - 1))
+	#error "EEPROM_QUEUE_SIZE must be a power of 2"
+#endif
+
+static struct {
+	uint8_t * address;
+	uint8_t   value;
+} queue[EEPROM_QUEUE_SIZE];
+
+static uint8_t queue_head;  // next to write
+static uint8_t queue_tail;  // next free slot
+
+#define  QUEUE_COUNT  ((uint8_t)(queue_tail - queue_head))
+#define  QUEUE_SLOT(i)  ((i) & (EEPROM_QUEUE_SIZE - 1))
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Queue a byte to be written to EEPROM
+ *
+ * Returns
+ * - true: on success
+ * - false: if the queue was full (nothing was queued)
+ */
+bool eeprom_queue_write(uint8_t * address, uint8_t value) {
+	if (QUEUE_COUNT == EEPROM_QUEUE_SIZE)
+		return false;
+	queue[QUEUE_SLOT(queue_tail)].address = address;
+	queue[QUEUE_SLOT(queue_tail)].value   = value;
+	queue_tail++;
+	return true;
+}
+
+bool eeprom_queue_pending(void) {
+	return queue_head != queue_tail;
+}
+
+/*
+ * Write the next queued byte, if the EEPROM isn't busy
+ *
+ * Note
+ * - Never waits for the EEPROM.  `eeprom_update_byte()` only waits for a
+ *   previous write to finish, and we've already checked that there isn't one.
+ */
+void eeprom_queue_task(void) {
+	if (!eeprom_queue_pending() || !eeprom_is_ready())
+		return;
+	eeprom_update_byte( queue[QUEUE_SLOT(queue_head)].address,
+	                    queue[QUEUE_SLOT(queue_head)].value );
+	queue_head++;
+}
+
@@ -0,0 +1,33 @@
+/* ----------------------------------------------------------------------------
+ * EEPROM write queue : exports
+ *
+ * Writing a byte of EEPROM takes ~3.4ms, during which the CPU would otherwise
+ * have to wait.  Writes are queued here instead, and performed one at a time
+ * by `eeprom_queue_task()` whenever the EEPROM is ready.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef LIB__EEPROM_QUEUE_h
+	#define LIB__EEPROM_QUEUE_h
+
+	#include <stdbool.h>
+	#include <stdint.h>
+
+	// --------------------------------------------------------------------
+
+	#ifndef EEPROM_QUEUE_SIZE
+		#define EEPROM_QUEUE_SIZE 16  // must be a power of 2
+	#endif
+
+	// --------------------------------------------------------------------
+
+	bool eeprom_queue_write   (uint8_t * address, uint8_t value);
+	bool eeprom_queue_pending (void);
+	void eeprom_queue_task    (void);
+
+#endif
+
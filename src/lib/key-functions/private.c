@@ -18,7 +18,7 @@
 
 /*
  * MediaCodeLookupTable is used to translate from enumeration in keyboard.h to
- *  consumer key scan code in usb_keyboard.h
+ *  consumer (or system control) key scan code in usb_keyboard.h
  */
 static const uint16_t _media_code_lookup_table[] = {
 	TRANSPORT_PLAY_PAUSE, /* MEDIAKEY_PLAY_PAUSE */
@@ -28,6 +28,9 @@ static const uint16_t _media_code_lookup_table[] = {
 	AUDIO_MUTE, /* MEDIAKEY_AUDIO_MUTE */
 	AUDIO_VOL_UP, /* MEDIAKEY_AUDIO_VOL_UP */
 	AUDIO_VOL_DOWN, /* MEDIAKEY_AUDIO_VOL_DOWN */
+	SYSTEM_POWER_DOWN, /* MEDIAKEY_SYSTEM_POWER_DOWN */
+	SYSTEM_SLEEP, /* MEDIAKEY_SYSTEM_SLEEP */
+	SYSTEM_WAKE_UP, /* MEDIAKEY_SYSTEM_WAKE_UP */
 };
 
 // ----------------------------------------------------------------------------
@@ -86,19 +89,12 @@ void _kbfun_press_release(bool press, uint8_t keycode) {
 	}
 
 	// all others
-	for (uint8_t i=0; i<6; i++) {
-		if (press) {
-			if (keyboard_keys[i] == 0) {
-				keyboard_keys[i] = keycode;
-				return;
-			}
-		} else {
-			if (keyboard_keys[i] == keycode) {
-				keyboard_keys[i] = 0;
-				return;
-			}
-		}
-	}
+	if (keycode >= KEYBOARD_KEYS_BYTES*8)
+		return;
+	if (press)
+		keyboard_key_set(keycode);
+	else
+		keyboard_key_clear(keycode);
 }
 
 /*
@@ -126,23 +122,37 @@ bool _kbfun_is_pressed(uint8_t keycode) {
 	}
 
 	// all others
-	for (uint8_t i=0; i<6; i++)
-		if (keyboard_keys[i] == keycode)
-			return true;
-
-	return false;
+	return keycode < KEYBOARD_KEYS_BYTES*8 && keyboard_key_is_set(keycode);
 }
 
 void _kbfun_mediakey_press_release(bool press, uint8_t keycode) {
+	if ( keycode >= sizeof(_media_code_lookup_table)
+	                / sizeof(_media_code_lookup_table[0]) )
+		return;
 	uint16_t mediakey_code = _media_code_lookup_table[keycode];
-	if (press) {
-		consumer_key = mediakey_code;
-	} else {
-		// Only one key can be pressed at a time so only clear the keypress for
-		//  active key (most recently pressed)
-		if (mediakey_code == consumer_key) {
-			consumer_key = 0;
+
+	if (keycode >= MEDIAKEY_SYSTEM_POWER_DOWN) {
+		// one system control key at a time: the most recently pressed
+		if (press)
+			system_key = mediakey_code;
+		else if (mediakey_code == system_key)
+			system_key = 0;
+		usb_extra_system_send();
+		return;
+	}
+
+	// press into a free slot (if all are taken, the press is lost), and
+	// release from whichever slot has it
+	uint16_t from = press ? 0 : mediakey_code;
+	uint16_t to   = press ? mediakey_code : 0;
+	for (uint8_t i=0; i<CONSUMER_KEYS; i++) {
+		if (consumer_keys[i] == from) {
+			consumer_keys[i] = to;
+			break;
 		}
 	}
+	// queue the change now, so a press and release in the same scan are both
+	// sent (if the queue is full, the extra report task sends it later)
+	usb_extra_consumer_send();
 }
 
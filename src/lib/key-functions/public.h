@@ -12,66 +12,122 @@
 
 	#include <stdbool.h>
 	#include <stdint.h>
+	#include "../data-types/misc.h"
 
 	// --------------------------------------------------------------------
 
 	// basic
-	void kbfun_press_release (void);
-	void kbfun_press_release_preserve_sticky (void);
-	void kbfun_toggle        (void);
-	void kbfun_transparent   (void);
+	void kbfun_press_release (key_event_t * event);
+	void kbfun_press_release_preserve_sticky (key_event_t * event);
+	void kbfun_toggle        (key_event_t * event);
+	void kbfun_transparent   (key_event_t * event);
 	// --- layer push/pop functions
-	void kbfun_layer_push_1  (void);
-	void kbfun_layer_push_2  (void);
-	void kbfun_layer_push_3  (void);
-	void kbfun_layer_push_4  (void);
-	void kbfun_layer_push_5  (void);
-	void kbfun_layer_push_6  (void);
-	void kbfun_layer_push_7  (void);
-	void kbfun_layer_push_8  (void);
-	void kbfun_layer_push_9  (void);
-	void kbfun_layer_push_10 (void);
-	void kbfun_layer_sticky_1  (void);
-	void kbfun_layer_sticky_2  (void);
-	void kbfun_layer_sticky_3  (void);
-	void kbfun_layer_sticky_4  (void);
-	void kbfun_layer_sticky_5  (void);
-	void kbfun_layer_sticky_6  (void);
-	void kbfun_layer_sticky_7  (void);
-	void kbfun_layer_sticky_8  (void);
-	void kbfun_layer_sticky_9  (void);
-	void kbfun_layer_sticky_10 (void);
-	void kbfun_layer_pop_1   (void);
-	void kbfun_layer_pop_2   (void);
-	void kbfun_layer_pop_3   (void);
-	void kbfun_layer_pop_4   (void);
-	void kbfun_layer_pop_5   (void);
-	void kbfun_layer_pop_6   (void);
-	void kbfun_layer_pop_7   (void);
-	void kbfun_layer_pop_8   (void);
-	void kbfun_layer_pop_9   (void);
-	void kbfun_layer_pop_10  (void);
-	void kbfun_layer_toggle_1   (void);
-	void kbfun_layer_toggle_2   (void);
-	void kbfun_layer_toggle_3   (void);
-	void kbfun_layer_toggle_4   (void);
-	void kbfun_layer_toggle_5   (void);
-	void kbfun_layer_toggle_6   (void);
-	void kbfun_layer_toggle_7   (void);
-	void kbfun_layer_toggle_8   (void);
-	void kbfun_layer_toggle_9   (void);
-	void kbfun_layer_toggle_10  (void);
+	void kbfun_layer_push_1  (key_event_t * event);
+	void kbfun_layer_push_2  (key_event_t * event);
+	void kbfun_layer_push_3  (key_event_t * event);
+	void kbfun_layer_push_4  (key_event_t * event);
+	void kbfun_layer_push_5  (key_event_t * event);
+	void kbfun_layer_push_6  (key_event_t * event);
+	void kbfun_layer_push_7  (key_event_t * event);
+	void kbfun_layer_push_8  (key_event_t * event);
+	void kbfun_layer_push_9  (key_event_t * event);
+	void kbfun_layer_push_10 (key_event_t * event);
+	void kbfun_layer_sticky_1  (key_event_t * event);
+	void kbfun_layer_sticky_2  (key_event_t * event);
+	void kbfun_layer_sticky_3  (key_event_t * event);
+	void kbfun_layer_sticky_4  (key_event_t * event);
+	void kbfun_layer_sticky_5  (key_event_t * event);
+	void kbfun_layer_sticky_6  (key_event_t * event);
+	void kbfun_layer_sticky_7  (key_event_t * event);
+	void kbfun_layer_sticky_8  (key_event_t * event);
+	void kbfun_layer_sticky_9  (key_event_t * event);
+	void kbfun_layer_sticky_10 (key_event_t * event);
+	void kbfun_layer_pop_1   (key_event_t * event);
+	void kbfun_layer_pop_2   (key_event_t * event);
+	void kbfun_layer_pop_3   (key_event_t * event);
+	void kbfun_layer_pop_4   (key_event_t * event);
+	void kbfun_layer_pop_5   (key_event_t * event);
+	void kbfun_layer_pop_6   (key_event_t * event);
+	void kbfun_layer_pop_7   (key_event_t * event);
+	void kbfun_layer_pop_8   (key_event_t * event);
+	void kbfun_layer_pop_9   (key_event_t * event);
+	void kbfun_layer_pop_10  (key_event_t * event);
+	void kbfun_layer_toggle_1   (key_event_t * event);
+	void kbfun_layer_toggle_2   (key_event_t * event);
+	void kbfun_layer_toggle_3   (key_event_t * event);
+	void kbfun_layer_toggle_4   (key_event_t * event);
+	void kbfun_layer_toggle_5   (key_event_t * event);
+	void kbfun_layer_toggle_6   (key_event_t * event);
+	void kbfun_layer_toggle_7   (key_event_t * event);
+	void kbfun_layer_toggle_8   (key_event_t * event);
+	void kbfun_layer_toggle_9   (key_event_t * event);
+	void kbfun_layer_toggle_10  (key_event_t * event);
 	// ---
 
 	// device
-	void kbfun_jump_to_bootloader (void);
+	void kbfun_jump_to_bootloader (key_event_t * event);
 
 	// special
-	void kbfun_shift_press_release           (void);
-	void kbfun_2_keys_capslock_press_release (void);
-	void kbfun_layer_push_numpad             (void);
-	void kbfun_layer_pop_numpad              (void);
-	void kbfun_mediakey_press_release        (void);
+	void kbfun_shift_press_release           (key_event_t * event);
+	void kbfun_2_keys_capslock_press_release (key_event_t * event);
+	void kbfun_layer_push_numpad             (key_event_t * event);
+	void kbfun_layer_pop_numpad              (key_event_t * event);
+	void kbfun_mediakey_press_release        (key_event_t * event);
+
+	// tap-dance
+	typedef struct {
+		uint16_t tap[3];   // single, double, triple tap
+		uint16_t hold[2];  // hold, tap then hold
+	} kbfun_tap_dance_t;
+
+	void kbfun_tap_dance_press_release (key_event_t * event,
+	                                    const kbfun_tap_dance_t * dance);
+	void kbfun_tap_dance_interrupt     (key_event_t * event);
+	void kbfun_tap_dance_tick          (uint16_t now);
+
+	// leader
+	typedef struct {
+		uint8_t  keycode;  // of the key that leads to this node
+		uint8_t  child;    // index of the first child, or 0
+		uint8_t  sibling;  // index of the next sibling, or 0
+		uint16_t action;   // sent if the sequence ends here, or 0
+	} kbfun_leader_node_t;
+
+	void     kbfun_leader_start  (key_event_t * event,
+	                              const kbfun_leader_node_t * trie);
+	bool     kbfun_leader_active (void);
+	uint16_t kbfun_leader_key    (key_event_t * event, uint16_t action);
+	void     kbfun_leader_tick   (uint16_t now);
+
+	// dynamic macro
+	void kbfun_dynamic_macro_record (void);
+	void kbfun_dynamic_macro_play   (void);
+	void kbfun_dynamic_macro_event  (uint16_t action, bool pressed);
+	void kbfun_dynamic_macro_tick   (void);
+
+	// macro
+	#define  KBFUN_MACRO_OP_MODS  0xF0
+	#define  KBFUN_MACRO_OP_DOWN  0xF1
+	#define  KBFUN_MACRO_OP_UP    0xF2
+
+	#define  KBFUN_MACRO_END            0
+	#define  KBFUN_MACRO_MODS(mask)     KBFUN_MACRO_OP_MODS, (mask)
+	#define  KBFUN_MACRO_DOWN(keycode)  KBFUN_MACRO_OP_DOWN, (keycode)
+	#define  KBFUN_MACRO_UP(keycode)    KBFUN_MACRO_OP_UP,   (keycode)
+
+	void kbfun_macro_play         (const uint8_t * macro);
+	void kbfun_macro_type         (const char * string);
+	void kbfun_macro_type_unicode (const char * string);
+	void kbfun_macro_tick         (void);
+
+	// unicode
+	#define  KBFUN_UNICODE_LINUX       0  // ctrl+shift+u (ibus)
+	#define  KBFUN_UNICODE_WINCOMPOSE  1  // right alt as the compose key
+	#define  KBFUN_UNICODE_MAC         2  // "Unicode Hex Input"
+
+	void    kbfun_unicode_set_mode (uint8_t mode);
+	void    kbfun_unicode_start    (const char * string);
+	uint8_t kbfun_unicode_next     (void);
 
 #endif
 
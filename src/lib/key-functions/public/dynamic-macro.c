@@ -0,0 +1,213 @@
+/* ----------------------------------------------------------------------------
+ * key functions : dynamic macro : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../../../usb_keyboard_rawhid.h"
+#include "../../../main.h"
+#include "../../modifiers.h"
+#include "../public.h"
+
+// ----------------------------------------------------------------------------
+
+// bytes of RAM to record into
+#define  ARENA_SIZE  128
+
+// in the arena, any other byte is a keycode, pressed
+#define  OP_RELEASE_LAST  0xE8  // release the key pressed last
+#define  OP_RELEASE       0xE9  // (then a keycode) release that key
+#define  OP_OVERRIDE      0xEA  // (then a modifier override) for the presses
+                                //   after this
+
+// the most reports one step of playback can queue (see `mods_press_key()`)
+#define  STEP_REPORTS  3
+
+// ----------------------------------------------------------------------------
+
+static uint8_t arena[ARENA_SIZE];
+static uint8_t length;
+
+static bool    recording;
+static uint8_t rec_down[256/8];  // keys pressed while recording, still down
+static uint8_t rec_down_count;
+static uint8_t rec_override;
+static uint8_t rec_last;
+
+static bool    playing;
+static uint8_t play_pos;
+static uint8_t play_override;
+static uint8_t play_last;
+
+// ----------------------------------------------------------------------------
+
+static bool is_down(uint8_t keycode) {
+	return rec_down[keycode >> 3] & (1 << (keycode & 7));
+}
+
+static void record_release(uint8_t keycode) {
+	rec_down[keycode >> 3] &= ~(1 << (keycode & 7));
+	rec_down_count--;
+
+	if (keycode == rec_last) {
+		arena[length++] = OP_RELEASE_LAST;
+	} else {
+		arena[length++] = OP_RELEASE;
+		arena[length++] = keycode;
+	}
+}
+
+/*
+ * Play the event at `play_pos`
+ */
+static void play_step(void) {
+	uint8_t op = arena[play_pos++];
+
+	if (op == OP_OVERRIDE) {
+		play_override = arena[play_pos++];
+		op = arena[play_pos++];
+	}
+
+	if (op == OP_RELEASE_LAST) {
+		main_action_release(play_last);
+	} else if (op == OP_RELEASE) {
+		main_action_release(arena[play_pos++]);
+	} else {
+		play_last = op;
+		if ((op & 0xF8) == 0xE0)
+			main_action_press(op);
+		else
+			main_action_press((play_override << 8) | op);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * [name]
+ *   Dynamic macro : record
+ *
+ * [description]
+ *   Start recording the keys pressed and released (as keycodes, after the
+ *   layout has been looked up) into a RAM arena, replacing the last
+ *   recording; or, if recording, stop
+ *
+ * [note]
+ *   - Recording is a couple of bytes written per key, in the normal path,
+ *     so it doesn't delay anything.
+ *   - Events are stored relative to the ones before them: a press is the
+ *     keycode alone, unless its modifier override changed; and releasing the
+ *     key pressed last (which is what usually happens) is a single byte.  So
+ *     a tap is 2 bytes.
+ *   - Room is always kept for the releases of the keys that are down, which
+ *     are recorded when recording stops, so that playback never leaves a key
+ *     pressed.  Presses that don't fit are dropped.
+ *   - Not of type `kbfun_funptr_t`: `main()` calls this for `DM_REC` keys.
+ */
+void kbfun_dynamic_macro_record(void) {
+	if (playing)
+		return;
+
+	if (recording) {
+		for (uint16_t keycode=0; rec_down_count; keycode++)
+			if (is_down(keycode))
+				record_release(keycode);
+		recording = false;
+		return;
+	}
+
+	for (uint8_t i=0; i<sizeof(rec_down); i++)
+		rec_down[i] = 0;
+	rec_down_count = 0;
+	rec_override   = 0;
+	rec_last       = 0;
+	length         = 0;
+	recording      = true;
+}
+
+/*
+ * [name]
+ *   Dynamic macro : play
+ *
+ * [description]
+ *   Play the last recording back (see `kbfun_dynamic_macro_tick()`)
+ *
+ * [note]
+ *   - Not of type `kbfun_funptr_t`: `main()` calls this for `DM_PLAY` keys.
+ */
+void kbfun_dynamic_macro_play(void) {
+	if (recording || playing || !length)
+		return;
+
+	play_pos      = 0;
+	play_override = 0;
+	play_last     = 0;
+	playing       = true;
+}
+
+/*
+ * Record a press or release of `action` (an entry from `custom_layout`, with
+ * a keycode in its low byte)
+ */
+void kbfun_dynamic_macro_event(uint16_t action, bool pressed) {
+	if (!recording)
+		return;
+
+	uint8_t keycode  = action & 0xFF;
+	uint8_t override = ((keycode & 0xF8) == 0xE0) ? rec_override : action >> 8;
+
+	if (!pressed) {
+		if (is_down(keycode))
+			record_release(keycode);
+		return;
+	}
+
+	if (is_down(keycode))
+		return;
+
+	// the press, its override if that changed, and all the releases
+	uint8_t needed = 1 + (override != rec_override ? 2 : 0)
+	                 + 2 * (rec_down_count + 1);
+	if (ARENA_SIZE - length < needed)
+		return;
+
+	if (override != rec_override) {
+		arena[length++] = OP_OVERRIDE;
+		arena[length++] = override;
+		rec_override = override;
+	}
+	arena[length++] = keycode;
+	rec_last = keycode;
+
+	rec_down[keycode >> 3] |= (1 << (keycode & 7));
+	rec_down_count++;
+}
+
+/*
+ * Queue as much of a recording being played back as the keyboard report
+ * queue has room for, one report per event
+ *
+ * Note
+ * - The queue is emptied one report per USB frame (see
+ *   "usb_keyboard_rawhid.c"), so playback goes as fast as the host will take
+ *   it, without ever waiting here.  Since this is called every scan, the
+ *   queue has to hold at least a scan's worth of frames for that to be true.
+ */
+void kbfun_dynamic_macro_tick(void) {
+	while ( playing
+	        && usb_keyboard_queued() < KEYBOARD_QUEUE_SIZE - STEP_REPORTS ) {
+		play_step();
+		if (play_pos >= length)
+			playing = false;
+
+		if (usb_keyboard_send())
+			break;  // not configured, or the queue is full after all
+		mods_report_sent();
+	}
+}
+
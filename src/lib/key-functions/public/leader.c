@@ -0,0 +1,115 @@
+/* ----------------------------------------------------------------------------
+ * key functions : leader : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "../../../main.h"
+#include "../../timer.h"
+#include "../public.h"
+
+// ----------------------------------------------------------------------------
+
+#define  LEADER_TERM  MAKEFILE_LEADER_TERM
+
+// ----------------------------------------------------------------------------
+
+static const kbfun_leader_node_t * trie;
+static bool     active;
+static uint8_t  node;   // index of the node we're at
+static uint16_t last;   // time of the last key in the sequence
+static uint16_t fired;  // action pressed by a timeout, to be released
+
+// ----------------------------------------------------------------------------
+
+/*
+ * [name]
+ *   Leader
+ *
+ * [description]
+ *   Start a leader sequence: the next keys pressed (by keycode) select an
+ *   action from `trie`, instead of doing what they normally would
+ *
+ * [arguments]
+ *   - trie: (in PROGMEM) the sequences; see `leader_trie` in "main.c"
+ *
+ * [note]
+ *   - Each key looks only at the children of the current node, so the cost
+ *     of a sequence depends on its length (and how many keys could follow
+ *     at each step), not on how many sequences there are.
+ *   - Not of type `kbfun_funptr_t`: `main()` calls this for `LEAD` keys.
+ */
+void kbfun_leader_start(key_event_t * event, const kbfun_leader_node_t * trie_) {
+	trie   = trie_;
+	active = true;
+	node   = 0;
+	last   = event->time;
+}
+
+bool kbfun_leader_active(void) {
+	return active;
+}
+
+/*
+ * Take a key pressed during a sequence
+ *
+ * Arguments
+ * - action: what the key would normally do
+ *
+ * Returns
+ * - what the key should do instead: the action at the end of the sequence,
+ *   if this key ends it; `action` for modifier keys, which aren't part of
+ *   sequences; or 0
+ *
+ * Note
+ * - A key that doesn't continue any sequence ends it, and does nothing
+ */
+uint16_t kbfun_leader_key(key_event_t * event, uint16_t action) {
+	uint8_t keycode = action & 0xFF;
+
+	if ((keycode & 0xF8) == 0xE0)
+		return action;
+
+	uint8_t child = pgm_read_byte(&trie[node].child);
+	while (child && pgm_read_byte(&trie[child].keycode) != keycode)
+		child = pgm_read_byte(&trie[child].sibling);
+
+	last = event->time;
+
+	if (!child) {
+		active = false;
+		return 0;
+	}
+
+	node = child;
+	if (pgm_read_byte(&trie[node].child))
+		return 0;  // there may be more
+
+	active = false;
+	return pgm_read_word(&trie[node].action);
+}
+
+/*
+ * End a sequence that has gone `LEADER_TERM` without a key, with the action
+ * at the node it got to (if there is one)
+ */
+void kbfun_leader_tick(uint16_t now) {
+	if (fired) {
+		main_action_release(fired);
+		fired = 0;
+	}
+
+	if (!active || timer_elapsed(last, now) < LEADER_TERM)
+		return;
+
+	active = false;
+	fired  = pgm_read_word(&trie[node].action);
+	main_action_press(fired);
+}
+
@@ -0,0 +1,277 @@
+/* ----------------------------------------------------------------------------
+ * key functions : macro : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "../../../usb_keyboard_rawhid.h"
+#include "../../../main.h"
+#include "../../usb/usage-page/keyboard.h"
+#include "../../modifiers.h"
+#include "../public.h"
+
+// ----------------------------------------------------------------------------
+
+#define  OP_END   0
+#define  OP_TAP   1
+#define  OP_DOWN  2
+#define  OP_UP    3
+
+// the most reports one step can queue (see `mods_press_key()`)
+#define  STEP_REPORTS  3
+
+// in `ascii`
+#define  S  0x80  // shifted
+
+// ----------------------------------------------------------------------------
+
+// keycode (and whether shift is needed) for each printable character, for a
+// US layout on the host; 0 for characters that can't be typed
+static const uint8_t PROGMEM ascii[128] = {
+	['\t'] = KEY_Tab,                  ['\n'] = KEY_ReturnEnter,
+	[' ']  = KEY_Spacebar,
+	['!']  = S|KEY_1_Exclamation,      ['"']  = S|KEY_SingleQuote_DoubleQuote,
+	['#']  = S|KEY_3_Pound,            ['$']  = S|KEY_4_Dollar,
+	['%']  = S|KEY_5_Percent,          ['&']  = S|KEY_7_Ampersand,
+	['\''] = KEY_SingleQuote_DoubleQuote,
+	['(']  = S|KEY_9_LeftParenthesis,  [')']  = S|KEY_0_RightParenthesis,
+	['*']  = S|KEY_8_Asterisk,         ['+']  = S|KEY_Equal_Plus,
+	[',']  = KEY_Comma_LessThan,       ['-']  = KEY_Dash_Underscore,
+	['.']  = KEY_Period_GreaterThan,   ['/']  = KEY_Slash_Question,
+	['0']  = KEY_0_RightParenthesis,   ['1']  = KEY_1_Exclamation,
+	['2']  = KEY_2_At,                 ['3']  = KEY_3_Pound,
+	['4']  = KEY_4_Dollar,             ['5']  = KEY_5_Percent,
+	['6']  = KEY_6_Caret,              ['7']  = KEY_7_Ampersand,
+	['8']  = KEY_8_Asterisk,           ['9']  = KEY_9_LeftParenthesis,
+	[':']  = S|KEY_Semicolon_Colon,    [';']  = KEY_Semicolon_Colon,
+	['<']  = S|KEY_Comma_LessThan,     ['=']  = KEY_Equal_Plus,
+	['>']  = S|KEY_Period_GreaterThan, ['?']  = S|KEY_Slash_Question,
+	['@']  = S|KEY_2_At,
+	['A']  = S|KEY_a_A,  ['B']  = S|KEY_b_B,  ['C']  = S|KEY_c_C,
+	['D']  = S|KEY_d_D,  ['E']  = S|KEY_e_E,  ['F']  = S|KEY_f_F,
+	['G']  = S|KEY_g_G,  ['H']  = S|KEY_h_H,  ['I']  = S|KEY_i_I,
+	['J']  = S|KEY_j_J,  ['K']  = S|KEY_k_K,  ['L']  = S|KEY_l_L,
+	['M']  = S|KEY_m_M,  ['N']  = S|KEY_n_N,  ['O']  = S|KEY_o_O,
+	['P']  = S|KEY_p_P,  ['Q']  = S|KEY_q_Q,  ['R']  = S|KEY_r_R,
+	['S']  = S|KEY_s_S,  ['T']  = S|KEY_t_T,  ['U']  = S|KEY_u_U,
+	['V']  = S|KEY_v_V,  ['W']  = S|KEY_w_W,  ['X']  = S|KEY_x_X,
+	['Y']  = S|KEY_y_Y,  ['Z']  = S|KEY_z_Z,
+	['[']  = KEY_LeftBracket_LeftBrace,
+	['\\'] = KEY_Backslash_Pipe,
+	[']']  = KEY_RightBracket_RightBrace,
+	['^']  = S|KEY_6_Caret,            ['_']  = S|KEY_Dash_Underscore,
+	['`']  = KEY_GraveAccent_Tilde,
+	['a']  = KEY_a_A,    ['b']  = KEY_b_B,    ['c']  = KEY_c_C,
+	['d']  = KEY_d_D,    ['e']  = KEY_e_E,    ['f']  = KEY_f_F,
+	['g']  = KEY_g_G,    ['h']  = KEY_h_H,    ['i']  = KEY_i_I,
+	['j']  = KEY_j_J,    ['k']  = KEY_k_K,    ['l']  = KEY_l_L,
+	['m']  = KEY_m_M,    ['n']  = KEY_n_N,    ['o']  = KEY_o_O,
+	['p']  = KEY_p_P,    ['q']  = KEY_q_Q,    ['r']  = KEY_r_R,
+	['s']  = KEY_s_S,    ['t']  = KEY_t_T,    ['u']  = KEY_u_U,
+	['v']  = KEY_v_V,    ['w']  = KEY_w_W,    ['x']  = KEY_x_X,
+	['y']  = KEY_y_Y,    ['z']  = KEY_z_Z,
+	['{']  = S|KEY_LeftBracket_LeftBrace,
+	['|']  = S|KEY_Backslash_Pipe,
+	['}']  = S|KEY_RightBracket_RightBrace,
+	['~']  = S|KEY_GraveAccent_Tilde,
+};
+
+// ----------------------------------------------------------------------------
+
+static enum {
+	SOURCE_MACRO,    // `stream` is a macro
+	SOURCE_TEXT,     // `stream` is a string
+	SOURCE_UNICODE,  // a macro made up as it goes, by "unicode.c"
+} source;
+
+static const uint8_t * stream;  // in PROGMEM
+static bool     playing;
+static uint8_t  mods;           // modifier override for taps, in a macro
+
+static uint8_t  next_op;        // the op after `tapped`, if `have_next`
+static uint16_t next_action;
+static bool     have_next;
+static uint16_t tapped;         // the key tapped last (still down), or 0
+
+// ----------------------------------------------------------------------------
+
+static uint8_t read(void) {
+	if (source == SOURCE_UNICODE)
+		return kbfun_unicode_next();
+	return pgm_read_byte(stream++);
+}
+
+/*
+ * Read the next op from the source
+ */
+static uint8_t fetch(uint16_t * action) {
+	uint8_t byte = read();
+
+	if (source == SOURCE_TEXT) {
+		uint8_t code;
+		while ( byte && !( code = (byte & 0x80)
+		                          ? 0 : pgm_read_byte(&ascii[byte]) ) )
+			byte = pgm_read_byte(stream++);
+
+		*action = ((code & S) ? 0x0200 : 0) | (code & ~S);
+		return byte ? OP_TAP : OP_END;
+	}
+
+	while (byte == KBFUN_MACRO_OP_MODS) {
+		mods = read();
+		byte = read();
+	}
+
+	if (byte == KBFUN_MACRO_OP_DOWN || byte == KBFUN_MACRO_OP_UP) {
+		*action = read();
+		return (byte == KBFUN_MACRO_OP_DOWN) ? OP_DOWN : OP_UP;
+	}
+
+	*action = ((uint16_t)mods << 8) | byte;
+	return byte ? OP_TAP : OP_END;
+}
+
+/*
+ * Change the report by one step
+ *
+ * Returns
+ * - whether the report changed (it doesn't at the end of a sequence that
+ *   ended with no key down)
+ *
+ * Note
+ * - A tapped key is released in the same report as the next key is pressed,
+ *   unless that's the same key again, in which case the release has to be a
+ *   report by itself.  So "abc" is 4 reports, and "aa" is 4 too.
+ */
+static bool step(void) {
+	if (!have_next) {
+		next_op   = fetch(&next_action);
+		have_next = true;
+	}
+
+	if (tapped) {
+		main_action_release(tapped);
+		bool alone = next_op != OP_TAP
+		             || (next_action & 0xFF) == (tapped & 0xFF);
+		tapped = 0;
+		if (alone && next_op != OP_END)
+			return true;
+	} else if (next_op == OP_END) {
+		playing = false;
+		return false;
+	}
+
+	have_next = false;
+	switch (next_op) {
+		case OP_END:   playing = false;
+		               break;
+		case OP_TAP:   main_action_press(next_action);
+		               tapped = next_action;
+		               break;
+		case OP_DOWN:  main_action_press(next_action);
+		               break;
+		case OP_UP:    main_action_release(next_action);
+		               break;
+	}
+	return true;
+}
+
+static void start(const void * stream_, uint8_t source_) {
+	stream    = stream_;
+	source    = source_;
+	playing   = true;
+	mods      = 0;
+	have_next = false;
+	tapped    = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * [name]
+ *   Macro : play
+ *
+ * [description]
+ *   Play a sequence of keys, stored in PROGMEM (see `KBFUN_MACRO_*` in
+ *   "../public.h")
+ *
+ * [arguments]
+ *   - macro: (in PROGMEM) keycodes to tap, with `KBFUN_MACRO_MODS()` to set
+ *     the modifiers for the taps after it, `KBFUN_MACRO_DOWN()` and
+ *     `KBFUN_MACRO_UP()` to hold keys (e.g. modifiers) across taps, and
+ *     ending with `KBFUN_MACRO_END`
+ *
+ * [note]
+ *   - Played by `kbfun_macro_tick()`.  Only one macro or string plays at a
+ *     time; starting another while one is playing does nothing.
+ *   - Not of type `kbfun_funptr_t`: `main()` calls this for `MACRO()` keys.
+ */
+void kbfun_macro_play(const uint8_t * macro) {
+	if (!playing)
+		start(macro, SOURCE_MACRO);
+}
+
+/*
+ * [name]
+ *   Macro : type
+ *
+ * [description]
+ *   Type a string, stored in PROGMEM, as a US layout host would read it
+ *
+ * [note]
+ *   - Characters that can't be typed are skipped.
+ *   - Not of type `kbfun_funptr_t`: `main()` calls this for `TEXT()` keys.
+ */
+void kbfun_macro_type(const char * string) {
+	if (!playing)
+		start(string, SOURCE_TEXT);
+}
+
+/*
+ * [name]
+ *   Macro : type unicode
+ *
+ * [description]
+ *   Type a string, stored in PROGMEM as UTF-8, one code point at a time, in
+ *   hex, with the input method set by `kbfun_unicode_set_mode()`
+ *
+ * [note]
+ *   - The keys for each code point are made up as they're needed (see
+ *     "unicode.c"), and played like a macro.
+ *   - Not of type `kbfun_funptr_t`: `main()` calls this for `UC()` keys.
+ */
+void kbfun_macro_type_unicode(const char * string) {
+	if (playing)
+		return;
+
+	kbfun_unicode_start(string);
+	start(0, SOURCE_UNICODE);
+}
+
+/*
+ * Queue as much of the macro or string being played as the keyboard report
+ * queue has room for, one report per step
+ *
+ * Note
+ * - Reports are taken off the queue by the start of frame interrupt, one per
+ *   frame, whenever the keyboard endpoint is ready for one (`RWAL`; see
+ *   "usb_keyboard_rawhid.c").  So this keeps up with the host, as long as
+ *   the queue holds a scan's worth of frames, without ever waiting.
+ */
+void kbfun_macro_tick(void) {
+	while ( playing
+	        && usb_keyboard_queued() < KEYBOARD_QUEUE_SIZE - STEP_REPORTS ) {
+		if (!step())
+			break;
+		if (usb_keyboard_send())
+			break;  // not configured, or the queue is full after all
+		mods_report_sent();
+	}
+}
+
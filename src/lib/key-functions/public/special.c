@@ -16,17 +16,6 @@
 #include "../public.h"
 #include "../private.h"
 
-// ----------------------------------------------------------------------------
-
-// convenience macros
-#define  LAYER         main_arg_layer
-#define  LAYER_OFFSET  main_arg_layer_offset
-#define  ROW           main_arg_row
-#define  COL           main_arg_col
-#define  IS_PRESSED    main_arg_is_pressed
-#define  WAS_PRESSED   main_arg_was_pressed
-
-
 // ----------------------------------------------------------------------------
 
 
@@ -38,9 +27,9 @@
  *   Generate a 'shift' press or release before the normal keypress or
  *   keyrelease
  */
-void kbfun_shift_press_release(void) {
-	_kbfun_press_release(IS_PRESSED, KEY_LeftShift);
-	kbfun_press_release();
+void kbfun_shift_press_release(key_event_t * event) {
+	_kbfun_press_release(event->pressed, KEY_LeftShift);
+	kbfun_press_release(event);
 }
 
 /*
@@ -58,20 +47,20 @@ void kbfun_shift_press_release(void) {
  *   Capslock will then be pressed and released, and the original state of the
  *   shifts will be restored
  */
-void kbfun_2_keys_capslock_press_release(void) {
+void kbfun_2_keys_capslock_press_release(key_event_t * event) {
 	static uint8_t keys_pressed;
 	static bool lshift_pressed;
 	static bool rshift_pressed;
 
-	uint8_t keycode = kb_layout_get(LAYER, ROW, COL);
+	uint8_t keycode = kb_layout_get(event->layer, event->row, event->col);
 
-	if (!IS_PRESSED) keys_pressed--;
+	if (!event->pressed) keys_pressed--;
 
 	// take care of the key that was actually pressed
-	_kbfun_press_release(IS_PRESSED, keycode);
+	_kbfun_press_release(event->pressed, keycode);
 
 	// take care of capslock (only on the press of the 2nd key)
-	if (keys_pressed == 1 && IS_PRESSED) {
+	if (keys_pressed == 1 && event->pressed) {
 		// save the state of left and right shift
 		lshift_pressed = _kbfun_is_pressed(KEY_LeftShift);
 		rshift_pressed = _kbfun_is_pressed(KEY_RightShift);
@@ -92,7 +81,7 @@ void kbfun_2_keys_capslock_press_release(void) {
 			_kbfun_press_release(true, KEY_RightShift);
 	}
 
-	if (IS_PRESSED) keys_pressed++;
+	if (event->pressed) keys_pressed++;
 }
 
 /* ----------------------------------------------------------------------------
@@ -121,8 +110,8 @@ static inline void numpad_toggle_numlock(void) {
  *   Meant to be assigned (along with "numpad off") instead of a normal numlock
  *   key
  */
-void kbfun_layer_push_numpad(void) {
-	uint8_t keycode = kb_layout_get(LAYER, ROW, COL);
+void kbfun_layer_push_numpad(key_event_t * event) {
+	uint8_t keycode = kb_layout_get(event->layer, event->row, event->col);
 	main_layers_pop_id(numpad_layer_id);
 	numpad_layer_id = main_layers_push(keycode, eStickyNone);
 	numpad_toggle_numlock();
@@ -141,7 +130,7 @@ void kbfun_layer_push_numpad(void) {
  *   Meant to be assigned (along with "numpad on") instead of a normal numlock
  *   key
  */
-void kbfun_layer_pop_numpad(void) {
+void kbfun_layer_pop_numpad(key_event_t * event) {
 	main_layers_pop_id(numpad_layer_id);
 	numpad_layer_id = 0;
 	numpad_toggle_numlock();
@@ -156,9 +145,9 @@ void kbfun_layer_pop_numpad(void) {
  *   previous track
  *
  */
-void kbfun_mediakey_press_release(void) {
-	uint8_t keycode = kb_layout_get(LAYER, ROW, COL);
-	_kbfun_mediakey_press_release(IS_PRESSED, keycode);
+void kbfun_mediakey_press_release(key_event_t * event) {
+	uint8_t keycode = kb_layout_get(event->layer, event->row, event->col);
+	_kbfun_mediakey_press_release(event->pressed, keycode);
 }
 
 /* ----------------------------------------------------------------------------
@@ -0,0 +1,211 @@
+/* ----------------------------------------------------------------------------
+ * key functions : tap dance : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "../../../main.h"
+#include "../../modifiers.h"
+#include "../../timer.h"
+#include "../public.h"
+
+// ----------------------------------------------------------------------------
+
+#define  TAP_DANCE_TERM  MAKEFILE_TAP_DANCE_TERM
+
+// how many dance keys can be holding their action down at once
+#define  TAP_DANCE_HELD_MAX  4
+
+// ----------------------------------------------------------------------------
+
+static enum {
+	TD_IDLE,
+	TD_PRESSED,   // the key is down, and may still turn out to be a tap
+	TD_RELEASED,  // the key is up, and may still be tapped again
+} state;
+
+static const kbfun_tap_dance_t * dance;
+static uint8_t  dance_row;
+static uint8_t  dance_col;
+static uint8_t  taps;  // how many times the key has been pressed
+static uint16_t last;  // time of the last press or release
+
+// the actions pressed for dances that ended in a hold, each until its own
+// key is released (0 for a free slot)
+static struct {
+	uint8_t  row;
+	uint8_t  col;
+	uint16_t action;
+} held[TAP_DANCE_HELD_MAX];
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Could another tap change the outcome?
+ */
+static bool more_possible(void) {
+	if (taps >= 3)
+		return false;
+	if (pgm_read_word(&dance->tap[taps]))
+		return true;
+	if (taps < 2 && pgm_read_word(&dance->hold[taps]))
+		return true;
+	return false;
+}
+
+/*
+ * Press and release `action`, sending the report with it pressed in between
+ * (modifiers don't send one themselves, so the host would never see them)
+ */
+static void press_release(uint16_t action) {
+	main_action_press(action);
+	mods_flush();
+	main_action_release(action);
+}
+
+static void tap(void) {
+	press_release(pgm_read_word(&dance->tap[taps-1]));
+	state = TD_IDLE;
+}
+
+/*
+ * Press the hold action for the dance, until its key is released
+ *
+ * Note
+ * - If `TAP_DANCE_HELD_MAX` other dance keys are already holding theirs
+ *   down, the action is tapped instead: the held ones stay as they are.
+ */
+static void hold(void) {
+	uint16_t action = (taps <= 2) ? pgm_read_word(&dance->hold[taps-1]) : 0;
+	if (!action)
+		action = pgm_read_word(&dance->tap[taps-1]);
+	state = TD_IDLE;
+
+	uint8_t slot = 0;
+	while (slot < TAP_DANCE_HELD_MAX && held[slot].action)
+		slot++;
+	if (slot == TAP_DANCE_HELD_MAX) {
+		press_release(action);
+		return;
+	}
+
+	main_action_press(action);
+	held[slot].row    = dance_row;
+	held[slot].col    = dance_col;
+	held[slot].action = action;
+}
+
+/*
+ * Release the action held for the key at (`row`, `col`), if there is one
+ *
+ * Returns
+ * - `true` if there was one
+ */
+static bool release_held(uint8_t row, uint8_t col) {
+	for (uint8_t i=0; i<TAP_DANCE_HELD_MAX; i++) {
+		if (held[i].action && held[i].row == row && held[i].col == col) {
+			main_action_release(held[i].action);
+			held[i].action = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * [name]
+ *   Tap dance
+ *
+ * [description]
+ *   Count taps of the key; after the last one, send the action for that
+ *   number of taps (or, if the key is still down, the hold action for it)
+ *
+ * [arguments]
+ *   - dance: (in PROGMEM) the actions to choose from.  Actions are entries
+ *     as in `custom_layout` (see "main.c"), and 0 means "none".
+ *
+ * [note]
+ *   - The outcome is decided, from event timestamps, as soon as it can't
+ *     change: when the key is released with no more outcomes to count up
+ *     to, when another key is pressed, or when `TAP_DANCE_TERM` passes
+ *     since the last press or release (see `kbfun_tap_dance_tick()`).
+ *     Nothing ever waits in a loop.
+ *   - Not of type `kbfun_funptr_t`: `main()` calls this for `TD()` keys,
+ *     with the dance from its table.
+ */
+void kbfun_tap_dance_press_release( key_event_t * event,
+                                    const kbfun_tap_dance_t * dance_ ) {
+	bool same = (state != TD_IDLE)
+	            && dance == dance_
+	            && dance_row == event->row
+	            && dance_col == event->col;
+
+	if (event->pressed) {
+		if (state != TD_IDLE && !same)
+			kbfun_tap_dance_interrupt(event);
+
+		if (state == TD_RELEASED) {
+			taps++;
+		} else {
+			dance     = dance_;
+			dance_row = event->row;
+			dance_col = event->col;
+			taps      = 1;
+		}
+		state = TD_PRESSED;
+		last  = event->time;
+		return;
+	}
+
+	if (release_held(event->row, event->col))
+		return;
+
+	if (!same)
+		return;
+
+	if (timer_elapsed(last, event->time) >= TAP_DANCE_TERM) {
+		// held past the term (before a tick noticed): a hold, now over
+		hold();
+		release_held(event->row, event->col);
+		return;
+	}
+
+	state = TD_RELEASED;
+	last  = event->time;
+	if (!more_possible())
+		tap();
+}
+
+/*
+ * Another key was pressed: the number of taps can't change any more
+ */
+void kbfun_tap_dance_interrupt(key_event_t * event) {
+	if (state == TD_RELEASED)
+		tap();
+	else if (state == TD_PRESSED)
+		hold();
+}
+
+/*
+ * Decide a dance once `TAP_DANCE_TERM` has passed without anything happening
+ */
+void kbfun_tap_dance_tick(uint16_t now) {
+	if (state == TD_IDLE)
+		return;
+	if (timer_elapsed(last, now) < TAP_DANCE_TERM)
+		return;
+
+	if (state == TD_RELEASED)
+		tap();
+	else
+		hold();
+}
+
@@ -0,0 +1,165 @@
+/* ----------------------------------------------------------------------------
+ * key functions : unicode : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "../../usb/usage-page/keyboard.h"
+#include "../public.h"
+
+// ----------------------------------------------------------------------------
+
+// bytes of macro (see "macro.c") for one code point; must be a power of 2
+#define  RING_SIZE  16
+
+// ----------------------------------------------------------------------------
+
+static const uint8_t PROGMEM hex_digits[16] = {
+	KEY_0_RightParenthesis, KEY_1_Exclamation, KEY_2_At, KEY_3_Pound,
+	KEY_4_Dollar, KEY_5_Percent, KEY_6_Caret, KEY_7_Ampersand,
+	KEY_8_Asterisk, KEY_9_LeftParenthesis,
+	KEY_a_A, KEY_b_B, KEY_c_C, KEY_d_D, KEY_e_E, KEY_f_F,
+};
+
+// ----------------------------------------------------------------------------
+
+static uint8_t      mode = KBFUN_UNICODE_LINUX;
+static const char * string;  // UTF-8, in PROGMEM
+
+static uint8_t ring[RING_SIZE];
+static uint8_t ring_head;  // next byte to be written
+static uint8_t ring_tail;  // next byte to be read
+
+// ----------------------------------------------------------------------------
+
+static void put(uint8_t byte) {
+	ring[ring_head] = byte;
+	ring_head = (ring_head + 1) & (RING_SIZE - 1);
+}
+
+/*
+ * Put the keycodes for the hex digits of `value` in the ring: all `digits`
+ * of them, or (if `digits` is 0) as few as it takes
+ */
+static void put_hex(uint32_t value, uint8_t digits) {
+	if (!digits)
+		for (digits = 1; digits < 8 && (value >> (4 * digits)); digits++);
+
+	while (digits--)
+		put(pgm_read_byte(&hex_digits[(value >> (4 * digits)) & 0xF]));
+}
+
+/*
+ * Decode the next code point from `string`, or return 0 at the end of it
+ *
+ * Note
+ * - Continuation bytes are taken as they come: a malformed string types
+ *   the wrong characters, but can't make this read past its end
+ */
+static uint32_t decode(void) {
+	uint8_t  byte = pgm_read_byte(string);
+	uint8_t  more;
+	uint32_t code;
+
+	if (!byte)
+		return 0;
+	string++;
+
+	if      (byte < 0xC0)  { more = 0; code = byte;        }
+	else if (byte < 0xE0)  { more = 1; code = byte & 0x1F; }
+	else if (byte < 0xF0)  { more = 2; code = byte & 0x0F; }
+	else                   { more = 3; code = byte & 0x07; }
+
+	while (more-- && (byte = pgm_read_byte(string))) {
+		code = (code << 6) | (byte & 0x3F);
+		string++;
+	}
+	return code;
+}
+
+/*
+ * Put the keys for typing `code` (with the current input method) in the ring
+ */
+static void encode(uint32_t code) {
+	switch (mode) {
+		case KBFUN_UNICODE_LINUX:
+			// ctrl+shift+u, the digits, space (ibus, gtk)
+			put(KBFUN_MACRO_OP_MODS); put(0x03);
+			put(KEY_u_U);
+			put(KBFUN_MACRO_OP_MODS); put(0x00);
+			put_hex(code, 0);
+			put(KEY_Spacebar);
+			break;
+
+		case KBFUN_UNICODE_WINCOMPOSE:
+			// the compose key (right alt), u, the digits, enter
+			put(KEY_RightAlt);
+			put(KEY_u_U);
+			put_hex(code, 0);
+			put(KEY_ReturnEnter);
+			break;
+
+		case KBFUN_UNICODE_MAC:
+			// the digits of each UTF-16 code unit, with option held
+			put(KBFUN_MACRO_OP_DOWN); put(KEY_LeftAlt);
+			if (code > 0xFFFF) {
+				code -= 0x10000;
+				put_hex(0xD800 | (code >> 10), 4);
+				code = 0xDC00 | (code & 0x3FF);
+			}
+			put_hex(code, 4);
+			put(KBFUN_MACRO_OP_UP); put(KEY_LeftAlt);
+			break;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * [name]
+ *   Unicode : set input method
+ *
+ * [arguments]
+ *   - mode_: one of `KBFUN_UNICODE_*`: how the host takes code points typed
+ *     in hex
+ */
+void kbfun_unicode_set_mode(uint8_t mode_) {
+	mode = mode_;
+}
+
+/*
+ * Start a string, for `kbfun_macro_type_unicode()` to play
+ */
+void kbfun_unicode_start(const char * string_) {
+	string    = string_;
+	ring_head = 0;
+	ring_tail = 0;
+}
+
+/*
+ * Return the next byte of macro (see "macro.c") for typing the string, or
+ * `KBFUN_MACRO_END` at the end of it
+ *
+ * Note
+ * - The keys for each code point are generated only once the ring is empty,
+ *   so the whole string never has to fit in RAM.
+ */
+uint8_t kbfun_unicode_next(void) {
+	if (ring_tail == ring_head) {
+		uint32_t code = decode();
+		if (!code)
+			return KBFUN_MACRO_END;
+		encode(code);
+	}
+
+	uint8_t byte = ring[ring_tail];
+	ring_tail = (ring_tail + 1) & (RING_SIZE - 1);
+	return byte;
+}
+
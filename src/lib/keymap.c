@@ -0,0 +1,372 @@
+/* ----------------------------------------------------------------------------
+ * keymap : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include "../usb_keyboard_rawhid.h"
+#include "./eeprom-queue.h"
+#include "./keymap.h"
+
+// ----------------------------------------------------------------------------
+
+// in `ee_cells`: use the value in flash (what erased EEPROM reads as; no
+// layout entry has an action kind of 0xFF)
+#define  UNSET  0xFFFF
+
+#define  READ_MAX   ((RAWHID_RX_SIZE - 8) / 2)
+#define  WRITE_MAX  ((RAWHID_RX_SIZE - 8) / 4)
+
+// ----------------------------------------------------------------------------
+
+typedef struct {
+	uint16_t cell;
+	uint16_t value;
+} edit_t;
+
+/*
+ * A commit is saved in steps, one byte at a time, through the EEPROM write
+ * queue: the edits go to a journal, the journal is marked full, the edits are
+ * applied, then the journal is marked empty.  So if power is lost part way,
+ * `keymap_init()` can finish the job.
+ */
+static enum {
+	STEP_IDLE,
+	STEP_JOURNAL,
+	STEP_MARK,
+	STEP_APPLY,
+	STEP_UNMARK,
+	STEP_RESET,  // erase `ee_cells`
+} step;
+
+// ----------------------------------------------------------------------------
+
+static uint16_t EEMEM ee_cells[KEYMAP_MAX_CELLS];
+static uint8_t  EEMEM ee_journal_count;  // edits in the journal, if valid
+static edit_t   EEMEM ee_journal[KEYMAP_EDITS];
+
+static const uint16_t * layout;  // in PROGMEM
+static uint8_t  dimensions[3];   // layers, rows, columns
+static uint16_t cells;           // that can be edited
+
+static edit_t   edits[2][KEYMAP_EDITS];  // being saved, and staged
+static uint8_t  edits_count[2];
+static uint8_t  live;            // which of `edits` is being saved
+
+// what `ee_cells` holds (or will, once saving is done), so that looking up a
+// key never has to read the EEPROM (which waits for any write in progress):
+// a bit per cell that has a saved value, and the values, sorted by cell
+static uint8_t  saved_bits[(KEYMAP_MAX_CELLS + 7) / 8];
+static edit_t   saved[KEYMAP_SAVED];
+static uint8_t  saved_count;
+
+static uint16_t step_pos;        // byte, within the step
+
+// ----------------------------------------------------------------------------
+
+static bool busy(void) {
+	return step != STEP_IDLE || eeprom_queue_pending();
+}
+
+static uint16_t get16(const uint8_t * p) {
+	return p[0] | (p[1] << 8);
+}
+
+static void put16(uint8_t * p, uint16_t value) {
+	p[0] = value & 0xFF;
+	p[1] = value >> 8;
+}
+
+static void start(uint8_t step_) {
+	step     = step_;
+	step_pos = 0;
+}
+
+static bool is_saved(uint16_t cell) {
+	return saved_bits[cell / 8] & (1 << (cell % 8));
+}
+
+/*
+ * Return the index of `cell` in `saved`, or where it would go
+ */
+static uint8_t saved_find(uint16_t cell) {
+	uint8_t low  = 0;
+	uint8_t high = saved_count;
+
+	while (low < high) {
+		uint8_t middle = (low + high) / 2;
+		if (saved[middle].cell < cell)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+/*
+ * Set the saved value of `cell` (there must be room, if it's new)
+ */
+static void saved_set(uint16_t cell, uint16_t value) {
+	uint8_t i = saved_find(cell);
+
+	if (!is_saved(cell)) {
+		for (uint8_t j=saved_count; j>i; j--)
+			saved[j] = saved[j-1];
+		saved_count++;
+		saved_bits[cell / 8] |= (1 << (cell % 8));
+	}
+	saved[i].cell  = cell;
+	saved[i].value = value;
+}
+
+/*
+ * Stage an edit (replacing any staged for the same cell)
+ */
+static void stage(uint16_t cell, uint16_t value) {
+	edit_t * e = edits[!live];
+	uint8_t  i;
+
+	for (i=0; i<edits_count[!live] && e[i].cell != cell; i++);
+	if (i == edits_count[!live])
+		edits_count[!live]++;
+	e[i].cell  = cell;
+	e[i].value = value;
+}
+
+static uint8_t command_read(uint8_t * packet) {
+	uint16_t first = get16(packet+4);
+	uint8_t  count = packet[6];
+
+	if (count > READ_MAX || first > cells || count > cells - first)
+		return KEYMAP_STATUS_BAD_ARGS;
+
+	for (uint8_t i=0; i<count; i++)
+		put16(packet+8+2*i, keymap_get(first+i));
+	return KEYMAP_STATUS_OK;
+}
+
+static uint8_t command_write(uint8_t * packet) {
+	uint8_t count = packet[4];
+	uint8_t added = 0;
+
+	if (count > WRITE_MAX)
+		return KEYMAP_STATUS_BAD_ARGS;
+
+	// check everything first, so that a write is staged whole or not at all
+	for (uint8_t i=0; i<count; i++) {
+		uint16_t cell  = get16(packet+8+4*i);
+		uint8_t  j;
+
+		if (cell >= cells || get16(packet+10+4*i) == UNSET)
+			return KEYMAP_STATUS_BAD_ARGS;
+		for ( j=0; j<edits_count[!live]
+		           && edits[!live][j].cell != cell; j++ );
+		if (j == edits_count[!live])
+			added++;  // (a cell twice in one write counts twice; harmless)
+	}
+	if (edits_count[!live] + added > KEYMAP_EDITS)
+		return KEYMAP_STATUS_FULL;
+
+	for (uint8_t i=0; i<count; i++)
+		stage(get16(packet+8+4*i), get16(packet+10+4*i));
+	return KEYMAP_STATUS_OK;
+}
+
+/*
+ * Make the staged edits live, and start saving them
+ *
+ * Note
+ * - The live edits from the last commit can only be dropped once they're in
+ *   EEPROM, which is why this waits for that (`KEYMAP_STATUS_BUSY`).
+ */
+static uint8_t command_commit(void) {
+	const edit_t * e     = edits[!live];
+	uint8_t        added = 0;
+
+	if (busy())
+		return KEYMAP_STATUS_BUSY;
+	if (!edits_count[!live])
+		return KEYMAP_STATUS_OK;
+
+	for (uint8_t i=0; i<edits_count[!live]; i++)
+		if (!is_saved(e[i].cell))
+			added++;  // (staged cells are all different)
+	if (saved_count + added > KEYMAP_SAVED)
+		return KEYMAP_STATUS_FULL;
+
+	for (uint8_t i=0; i<edits_count[!live]; i++)
+		saved_set(e[i].cell, e[i].value);
+	live = !live;
+	edits_count[!live] = 0;
+	start(STEP_JOURNAL);
+	return KEYMAP_STATUS_OK;
+}
+
+static uint8_t command_reset(void) {
+	if (busy())
+		return KEYMAP_STATUS_BUSY;
+
+	edits_count[0] = 0;
+	edits_count[1] = 0;
+	for (uint8_t i=0; i<sizeof(saved_bits); i++)
+		saved_bits[i] = 0;
+	saved_count = 0;
+	start(STEP_RESET);
+	return KEYMAP_STATUS_OK;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Arguments
+ * - layout: (in PROGMEM) `layers * rows * columns` layout entries
+ *
+ * Note
+ * - If a commit was being saved when the keyboard lost power, this finishes
+ *   saving it (waiting for the EEPROM; this is only run once, at startup)
+ * - Saved cells past the first `KEYMAP_SAVED` (possible only if that was
+ *   made smaller) are ignored
+ */
+void keymap_init( const uint16_t * layout_,
+                  uint8_t layers, uint8_t rows, uint8_t columns ) {
+	layout        = layout_;
+	dimensions[0] = layers;
+	dimensions[1] = rows;
+	dimensions[2] = columns;
+	cells         = layers * rows * columns;
+	if (cells > KEYMAP_MAX_CELLS)
+		cells = KEYMAP_MAX_CELLS;
+
+	uint8_t count = eeprom_read_byte(&ee_journal_count);
+	if (count && count <= KEYMAP_EDITS) {
+		for (uint8_t i=0; i<count; i++) {
+			edit_t e;
+			eeprom_read_block(&e, &ee_journal[i], sizeof(e));
+			if (e.cell < KEYMAP_MAX_CELLS)
+				eeprom_update_word(&ee_cells[e.cell], e.value);
+		}
+		eeprom_update_byte(&ee_journal_count, 0);
+	}
+
+	for (uint16_t cell=0; cell<cells && saved_count<KEYMAP_SAVED; cell++) {
+		uint16_t value = eeprom_read_word(&ee_cells[cell]);
+		if (value != UNSET)
+			saved_set(cell, value);
+	}
+}
+
+/*
+ * Return the layout entry for `cell` (see "keymap.h"): the saved one (from
+ * RAM), if there is one, or else the one in flash
+ */
+uint16_t keymap_get(uint16_t cell) {
+	if (cell < cells && is_saved(cell))
+		return saved[saved_find(cell)].value;
+	return pgm_read_word(&layout[cell]);
+}
+
+/*
+ * Carry out a command, and write the reply over it
+ *
+ * Returns
+ * - whether `packet` was a keymap command (and should be sent back).  Any
+ *   packet starting with `KEYMAP_VERSION` is: one with a command this
+ *   doesn't know gets `KEYMAP_STATUS_UNKNOWN`, so the host isn't left
+ *   waiting for a reply.
+ */
+bool keymap_command(uint8_t * packet) {
+	if (packet[0] != KEYMAP_VERSION)
+		return false;
+
+	uint8_t status = KEYMAP_STATUS_OK;
+	switch (packet[1]) {
+		case KEYMAP_CMD_INFO:
+			packet[4] = dimensions[0];
+			packet[5] = dimensions[1];
+			packet[6] = dimensions[2];
+			packet[7] = KEYMAP_EDITS;
+			packet[8] = edits_count[!live];
+			packet[9] = busy();
+			packet[10] = saved_count;
+			packet[11] = KEYMAP_SAVED;
+			break;
+		case KEYMAP_CMD_READ:     status = command_read(packet);   break;
+		case KEYMAP_CMD_WRITE:    status = command_write(packet);  break;
+		case KEYMAP_CMD_COMMIT:   status = command_commit();       break;
+		case KEYMAP_CMD_DISCARD:  edits_count[!live] = 0;          break;
+		case KEYMAP_CMD_RESET:    status = command_reset();        break;
+		default:                  status = KEYMAP_STATUS_UNKNOWN;  break;
+	}
+	packet[3] = status;
+	return true;
+}
+
+/*
+ * Queue as much of a commit (or reset) as the EEPROM write queue has room for
+ */
+void keymap_task(void) {
+	const edit_t * e = edits[live];
+	uint8_t        count = edits_count[live];
+	uint8_t *      address;
+	uint8_t        value;
+
+	for (;;) {
+		switch (step) {
+			case STEP_IDLE:
+			default:
+				return;
+
+			case STEP_JOURNAL:
+				if (step_pos == count * sizeof(edit_t)) {
+					start(STEP_MARK);
+					continue;
+				}
+				address = (uint8_t *)ee_journal + step_pos;
+				value   = ((const uint8_t *)e)[step_pos];
+				break;
+
+			case STEP_MARK:
+			case STEP_UNMARK:
+				if (step_pos) {
+					start(step == STEP_MARK ? STEP_APPLY : STEP_IDLE);
+					continue;
+				}
+				address = &ee_journal_count;
+				value   = (step == STEP_MARK) ? count : 0;
+				break;
+
+			case STEP_APPLY:
+				if (step_pos == count * 2) {
+					start(STEP_UNMARK);
+					continue;
+				}
+				address = (uint8_t *)&ee_cells[e[step_pos/2].cell]
+				          + (step_pos & 1);
+				value   = ((const uint8_t *)&e[step_pos/2].value)
+				          [step_pos & 1];
+				break;
+
+			case STEP_RESET:
+				if (step_pos == sizeof(ee_cells)) {
+					if (!eeprom_queue_pending())
+						start(STEP_IDLE);
+					return;
+				}
+				address = (uint8_t *)ee_cells + step_pos;
+				value   = 0xFF;
+				break;
+		}
+
+		if (!eeprom_queue_write(address, value))
+			return;
+		step_pos++;
+	}
+}
+
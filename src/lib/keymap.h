@@ -0,0 +1,82 @@
+/* ----------------------------------------------------------------------------
+ * keymap : exports
+ *
+ * The layout, as the key processing sees it: the one in flash, with edits
+ * made over the raw HID interface on top.  Edits are staged in RAM, and on
+ * commit swapped in whole (between scans, since everything here runs from
+ * the scheduler) and written to EEPROM in the background, so they last.
+ * Saved cells are kept in RAM as well, so key lookups never wait on the
+ * EEPROM.
+ * ----------------------------------------------------------------------------
+ * Commands (and their replies) are raw HID packets:
+ * - byte 0: `KEYMAP_VERSION`
+ * - byte 1: a `KEYMAP_CMD_*`
+ * - byte 2: a tag, chosen by the host, returned in the reply
+ * - byte 3: (in the reply) a `KEYMAP_STATUS_*`
+ * - from byte 4: arguments, or results (multi-byte values little endian)
+ *
+ * - `KEYMAP_CMD_INFO`: results: layers, rows, columns, `KEYMAP_EDITS`, the
+ *   number of edits staged, whether a commit is still being written, the
+ *   number of cells saved, and `KEYMAP_SAVED`
+ * - `KEYMAP_CMD_READ`: arguments: the first cell (16 bits), and a count (up
+ *   to 28); results: the same, then (from byte 8) the cells' values
+ * - `KEYMAP_CMD_WRITE`: arguments: a count (up to 14), then (from byte 8)
+ *   the cell (16 bits) and value (16 bits) for each edit to stage
+ * - `KEYMAP_CMD_COMMIT`: make the staged edits live, and save them (or,
+ *   `KEYMAP_STATUS_FULL`, if that would be more than `KEYMAP_SAVED` cells)
+ * - `KEYMAP_CMD_DISCARD`: drop the staged edits
+ * - `KEYMAP_CMD_RESET`: drop all edits, live and saved
+ *
+ * Cells are numbered in the order of the layout in flash (layer, then row,
+ * then column, as written in the source).  Values are layout entries, as in
+ * `custom_layout` ("main.c").
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef LIB__KEYMAP_h
+	#define LIB__KEYMAP_h
+
+	#include <stdbool.h>
+	#include <stdint.h>
+
+	// --------------------------------------------------------------------
+
+	#ifndef KEYMAP_EDITS
+		#define KEYMAP_EDITS 32  // edits per commit
+	#endif
+	#ifndef KEYMAP_MAX_CELLS
+		#define KEYMAP_MAX_CELLS 336  // cells saved in EEPROM
+	#endif
+	#ifndef KEYMAP_SAVED
+		#define KEYMAP_SAVED 48  // cells that may differ from flash
+	#endif
+
+	#define KEYMAP_VERSION  1
+
+	#define KEYMAP_CMD_INFO     0x10
+	#define KEYMAP_CMD_READ     0x11
+	#define KEYMAP_CMD_WRITE    0x12
+	#define KEYMAP_CMD_COMMIT   0x13
+	#define KEYMAP_CMD_DISCARD  0x14
+	#define KEYMAP_CMD_RESET    0x15
+
+	#define KEYMAP_STATUS_OK        0
+	#define KEYMAP_STATUS_BUSY      1  // the last commit is still being saved
+	#define KEYMAP_STATUS_FULL      2  // too many edits staged, or saved
+	#define KEYMAP_STATUS_BAD_ARGS  3
+	#define KEYMAP_STATUS_UNKNOWN   4  // not a command this version knows
+
+	// --------------------------------------------------------------------
+
+	void     keymap_init    ( const uint16_t * layout,
+	                          uint8_t layers, uint8_t rows, uint8_t columns );
+	uint16_t keymap_get     (uint16_t cell);
+	bool     keymap_command (uint8_t * packet);
+	void     keymap_task    (void);
+
+#endif
+
@@ -0,0 +1,246 @@
+/* ----------------------------------------------------------------------------
+ * modifier override engine : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../usb_keyboard_rawhid.h"
+#include "../main.h"
+#include "./timer.h"
+#include "./modifiers.h"
+
+// ----------------------------------------------------------------------------
+
+#define  ONESHOT_TIMEOUT  MAKEFILE_ONESHOT_TIMEOUT
+
+// ----------------------------------------------------------------------------
+
+// modifiers held by modifier keys
+static uint8_t mods_direct;
+// modifiers XORed with `mods_direct` for every key in the report
+static uint8_t mods_override;
+// the keys in `keyboard_keys` that have not been sent to the host yet (as a
+// bitmap, in the same format)
+static uint8_t mods_unsent[KEYBOARD_KEYS_BYTES];
+
+// how many extra reports have had to be sent to resolve conflicts
+uint16_t mods_intermediate_reports;
+
+// one-shot modifiers: the state of each (by bit), which of the ones whose keys
+// are down have been used, and when the last one was let go of
+static StickyState mods_sticky[8];
+static uint8_t     mods_sticky_used;
+static uint16_t    mods_sticky_time;
+
+// ----------------------------------------------------------------------------
+
+static void mods_update(void) {
+	keyboard_modifier_keys = mods_direct ^ mods_override;
+}
+
+/*
+ * The one-shot modifiers that apply to the next key
+ */
+static uint8_t mods_sticky_mask(void) {
+	uint8_t mask = 0;
+	for (uint8_t i=0; i<8; i++)
+		if (mods_sticky[i] != eStickyNone)
+			mask |= (1<<i);
+	return mask;
+}
+
+static bool mods_is_unsent(uint8_t keycode) {
+	return mods_unsent[keycode >> 3] & (1 << (keycode & 7));
+}
+
+static bool mods_any(const uint8_t * keys) {
+	uint8_t any = 0;
+	for (uint8_t i=0; i<KEYBOARD_KEYS_BYTES; i++)
+		any |= keys[i];
+	return any;
+}
+
+static void mods_clear(uint8_t * keys) {
+	for (uint8_t i=0; i<KEYBOARD_KEYS_BYTES; i++)
+		keys[i] = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Queue the report as it is now, so that no key in it gets lost
+ *
+ * Returns
+ * - The status of `usb_keyboard_send()`: 0 on success, or -1 if there was no
+ *   room for the report.  In that case the keys in it are still unsent.
+ *
+ * Note
+ * - Callers make sure there's room first (see `MAIN_EVENT_REPORTS` in
+ *   "main.c"), since a key pressed over a report that didn't go out is lost.
+ */
+int8_t mods_flush(void) {
+	if (usb_keyboard_send())
+		return -1;
+	mods_clear(mods_unsent);
+	mods_intermediate_reports++;
+	return 0;
+}
+
+/*
+ * Press a (non-modifier) key, with the given modifier override
+ *
+ * Note
+ * - Keys already in the report with a different override are released, and
+ *   so is a key with the same keycode (so that the host sees it pressed
+ *   again).  If any of them has not been sent yet, the report as it was is
+ *   sent first, so that the host still sees it with its own modifiers.  If the
+ *   keycode was already in the report, the release is sent too.  Otherwise,
+ *   no extra report is needed: the next report releases the old keys and
+ *   presses the new one under the new modifiers at once.
+ */
+void mods_press_key(uint8_t keycode, uint8_t override) {
+	if (keycode >= KEYBOARD_KEYS_BYTES*8)
+		return;
+
+	// fold one-shot modifiers into this key's override, so that they go out
+	// with it, in the same report
+	override ^= mods_sticky_mask() & ~mods_direct;
+	for (uint8_t i=0; i<8; i++) {
+		if (mods_sticky[i] == eStickyOnceUp)
+			mods_sticky[i] = eStickyNone;
+		else if (mods_sticky[i] == eStickyOnceDown)
+			mods_sticky_used |= (1<<i);
+	}
+
+	bool repeat   = keyboard_key_is_set(keycode);
+	bool conflict = (override != mods_override)
+	                ? mods_any(mods_unsent)
+	                : (repeat && mods_is_unsent(keycode));
+
+	if (conflict)
+		mods_flush();
+
+	if (override != mods_override)
+		mods_clear(keyboard_keys);
+	else
+		keyboard_key_clear(keycode);
+
+	if (repeat)
+		mods_flush();
+
+	keyboard_key_set(keycode);
+	mods_unsent[keycode >> 3] |= (1 << (keycode & 7));
+
+	mods_override = override;
+	mods_update();
+}
+
+/*
+ * Release a (non-modifier) key
+ *
+ * Note
+ * - The key may already have been dropped by a conflicting press, in which
+ *   case there is nothing to do
+ * - If the key was never sent, the report with it in is sent first, so that
+ *   quick taps are not lost
+ */
+void mods_release_key(uint8_t keycode) {
+	if (keycode >= KEYBOARD_KEYS_BYTES*8)
+		return;
+
+	if (keyboard_key_is_set(keycode)) {
+		if (mods_is_unsent(keycode))
+			mods_flush();
+		keyboard_key_clear(keycode);
+	}
+
+	if (!mods_any(keyboard_keys))
+		mods_override = 0;
+	mods_update();
+}
+
+/*
+ * Press or release modifier keys (as a mask, in report order)
+ */
+void mods_press_mod(uint8_t mask) {
+	mods_direct |= mask;
+	mods_update();
+}
+void mods_release_mod(uint8_t mask) {
+	mods_direct &= ~mask;
+	mods_update();
+}
+
+/*
+ * Press or release one-shot modifier keys (as a mask, in report order)
+ *
+ * Note
+ * - A one-shot modifier applies to the next non-modifier key (or, if that is
+ *   pressed while the one-shot key is still down, to every key pressed until
+ *   it is let go of).  Tapping it again while it's waiting locks it, and once
+ *   more unlocks it.  If `ONESHOT_TIMEOUT` is not 0, one that has waited that
+ *   long (in ms) is dropped.
+ * - One-shot modifiers never change the report by themselves (see
+ *   `mods_press_key()`), so the host never sees a modifier-only report for
+ *   them.
+ */
+void mods_oneshot_press(uint8_t mask) {
+	for (uint8_t i=0; i<8; i++) {
+		if (!(mask & (1<<i)))
+			continue;
+
+		switch (mods_sticky[i]) {
+			case eStickyNone:     mods_sticky[i] = eStickyOnceDown;
+			                      mods_sticky_used &= ~(1<<i);
+			                      break;
+			case eStickyOnceUp:   mods_sticky[i] = eStickyLock;
+			                      break;
+			default:              mods_sticky[i] = eStickyNone;
+			                      break;
+		}
+	}
+}
+void mods_oneshot_release(uint8_t mask) {
+	for (uint8_t i=0; i<8; i++) {
+		if (!(mask & (1<<i)) || mods_sticky[i] != eStickyOnceDown)
+			continue;
+
+		mods_sticky[i] = (mods_sticky_used & (1<<i))
+		                 ? eStickyNone : eStickyOnceUp;
+	}
+	mods_sticky_time = timer_get_ms();
+}
+
+/*
+ * Drop one-shot modifiers that have waited too long
+ */
+void mods_oneshot_tick(uint16_t now) {
+	if (!ONESHOT_TIMEOUT)
+		return;
+	if (timer_elapsed(mods_sticky_time, now) < ONESHOT_TIMEOUT)
+		return;
+
+	for (uint8_t i=0; i<8; i++)
+		if (mods_sticky[i] == eStickyOnceUp)
+			mods_sticky[i] = eStickyNone;
+}
+
+/*
+ * To be called after the keyboard report has been sent
+ */
+void mods_report_sent(void) {
+	mods_clear(mods_unsent);
+}
+
+uint8_t mods_get_direct(void) {
+	return mods_direct;
+}
+uint8_t mods_get_override(void) {
+	return mods_override;
+}
+
@@ -0,0 +1,40 @@
+/* ----------------------------------------------------------------------------
+ * modifier override engine : exports
+ *
+ * Keys in the layout may carry a set of modifiers that is XORed with the
+ * modifiers physically held while they are down (e.g. '!' as shifted '1').
+ * Every key in the keyboard report at any one time has to share the same
+ * override, or the host would see some of them with the wrong modifiers.
+ * This keeps track of that, dropping keys and sending intermediate reports
+ * only when overlapping keys actually conflict.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef LIB__MODIFIERS_h
+	#define LIB__MODIFIERS_h
+
+	#include <stdbool.h>
+	#include <stdint.h>
+
+	// --------------------------------------------------------------------
+
+	void    mods_press_key       (uint8_t keycode, uint8_t override);
+	void    mods_release_key     (uint8_t keycode);
+	void    mods_press_mod       (uint8_t mask);
+	void    mods_release_mod     (uint8_t mask);
+	void    mods_oneshot_press   (uint8_t mask);
+	void    mods_oneshot_release (uint8_t mask);
+	void    mods_oneshot_tick    (uint16_t now);
+	int8_t  mods_flush           (void);
+	void    mods_report_sent     (void);
+	uint8_t mods_get_direct      (void);
+	uint8_t mods_get_override    (void);
+
+	extern uint16_t mods_intermediate_reports;
+
+#endif
+
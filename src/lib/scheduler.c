@@ -0,0 +1,132 @@
+/* ----------------------------------------------------------------------------
+ * scheduler : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "./debug.h"
+#include "./timer.h"
+#include "./scheduler.h"
+
+// ----------------------------------------------------------------------------
+
+// total deadline misses, over all tasks
+uint16_t sched_misses;
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Release all periodic tasks, starting now
+ */
+void sched_init(sched_task_t * tasks, uint8_t count) {
+	uint16_t now = timer_get_ms();
+
+	for (uint8_t i=0; i<count; i++) {
+		tasks[i].release = now;
+		tasks[i].ready   = false;
+		tasks[i].armed   = false;
+		tasks[i].misses  = 0;
+	}
+	sched_misses = 0;
+}
+
+/*
+ * Make a task ready to run
+ *
+ * Note
+ * - Triggering a task that is already ready does not move its deadline
+ */
+void sched_trigger(sched_task_t * task) {
+	if (task->ready)
+		return;
+	task->release = timer_get_ms();
+	task->ready   = true;
+	task->armed   = false;
+}
+
+/*
+ * Make a task ready to run at `time` (in ms, as from `timer_get_ms()`)
+ *
+ * Note
+ * - This replaces any time the task was armed for before
+ * - `sched_run()` is called all the time from the main loop, so the task
+ *   becomes ready within the ms, however long the scan period is
+ */
+void sched_trigger_at(sched_task_t * task, uint16_t time) {
+	if (task->ready)
+		return;
+	task->release = time;
+	task->armed   = true;
+}
+
+/*
+ * Stop a task that is ready, or armed, from running
+ */
+void sched_cancel(sched_task_t * task) {
+	task->ready = false;
+	task->armed = false;
+}
+
+/*
+ * Run the ready task with the earliest deadline, if there is one
+ *
+ * Returns
+ * - true: if a task was run
+ * - false: if nothing was ready
+ */
+bool sched_run(sched_task_t * tasks, uint8_t count) {
+	uint16_t now = timer_get_ms();
+	sched_task_t * next = NULL;
+	uint16_t next_deadline = 0;
+
+	for (uint8_t i=0; i<count; i++) {
+		sched_task_t * task = &tasks[i];
+
+		if (task->period && !task->ready && timer_reached(task->release, now))
+			task->ready = true;
+		if (task->armed && timer_reached(task->release, now)) {
+			task->ready = true;
+			task->armed = false;
+		}
+
+		if (!task->ready)
+			continue;
+
+		uint16_t deadline = task->release + task->deadline;
+		if (!next || (int16_t)(deadline - next_deadline) < 0) {
+			next = task;
+			next_deadline = deadline;
+		}
+	}
+
+	if (!next)
+		return false;
+
+	next->ready = false;
+	if (next->period) {
+		next->release += next->period;
+		// if we've fallen more than a period behind, skip ahead rather
+		// than running the task back to back to catch up
+		if (timer_reached(next->release, now))
+			next->release = now + next->period;
+	}
+
+	(*next->run)();
+
+	int16_t late = timer_get_ms() - next_deadline;
+	if (late > 0) {
+		next->misses++;
+		sched_misses++;
+		debug_printf( "sched: task %u missed its deadline by %d ms\n",
+		              (unsigned)(next - tasks), late );
+	}
+
+	return true;
+}
+
@@ -0,0 +1,63 @@
+/* ----------------------------------------------------------------------------
+ * scheduler : exports
+ *
+ * A very small cooperative (run to completion) scheduler.  Each task is
+ * either periodic, or triggered by other code (now, or at a given time), and
+ * has a deadline relative to the time it became ready.  Of the ready tasks,
+ * the one with the earliest deadline runs first.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef LIB__SCHEDULER_h
+	#define LIB__SCHEDULER_h
+
+	#include <stdbool.h>
+	#include <stdint.h>
+	#include "./data-types/misc.h"
+
+	// --------------------------------------------------------------------
+
+	/*
+	 * - 'run': the task function; must return in bounded time
+	 * - 'period': in ms; 0 for tasks that only run when triggered
+	 * - 'deadline': in ms, after the task became ready, by which it
+	 *   should have finished running
+	 * - 'release': (state) when the task became (or will next become)
+	 *   ready
+	 * - 'ready': (state) whether the task is waiting to run
+	 * - 'armed': (state) whether the task will be ready at 'release'
+	 *   (for triggered tasks)
+	 * - 'misses': (statistics) how many times the task finished after its
+	 *   deadline
+	 */
+	typedef struct sched_task {
+		void_funptr_t run;
+		uint16_t      period;
+		uint16_t      deadline;
+		uint16_t      release;
+		bool          ready;
+		bool          armed;
+		uint16_t      misses;
+	} sched_task_t;
+
+	#define SCHED_PERIODIC(function, period, deadline)  \
+		{ (function), (period), (deadline), 0, false, false, 0 }
+	#define SCHED_TRIGGERED(function, deadline)  \
+		{ (function), 0, (deadline), 0, false, false, 0 }
+
+	// --------------------------------------------------------------------
+
+	void sched_init       (sched_task_t * tasks, uint8_t count);
+	void sched_trigger    (sched_task_t * task);
+	void sched_trigger_at (sched_task_t * task, uint16_t time);
+	void sched_cancel     (sched_task_t * task);
+	bool sched_run        (sched_task_t * tasks, uint8_t count);
+
+	extern uint16_t sched_misses;
+
+#endif
+
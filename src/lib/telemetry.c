@@ -0,0 +1,151 @@
+/* ----------------------------------------------------------------------------
+ * telemetry : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../usb_keyboard_rawhid.h"
+#include "./modifiers.h"
+#include "./scheduler.h"
+#include "./timer.h"
+#include "./telemetry.h"
+
+// ----------------------------------------------------------------------------
+
+#define  HEADER_SIZE  4
+#define  MAX_EVENTS   ((RAWHID_TX_SIZE - HEADER_SIZE - 2) / 2)
+
+// ----------------------------------------------------------------------------
+
+static uint8_t  events[RAWHID_TX_SIZE];  // the packet being filled
+static uint8_t  events_count;
+static uint16_t events_time;             // of the first event
+
+static uint8_t  packet_number;
+static uint16_t stats_time;              // when stats were last sent
+
+static uint16_t scans;
+static uint16_t events_total;
+static uint16_t events_lost;
+
+// ----------------------------------------------------------------------------
+
+static void put16(uint8_t * p, uint16_t value) {
+	p[0] = value & 0xFF;
+	p[1] = value >> 8;
+}
+
+/*
+ * Fill in the header, and send the packet if the endpoint has room for it
+ *
+ * Returns
+ * - whether the packet was sent
+ */
+static bool send(uint8_t * packet, uint8_t type, uint8_t count) {
+	packet[0] = TELEMETRY_VERSION;
+	packet[1] = type;
+	packet[2] = packet_number;
+	packet[3] = count;
+
+	if (usb_rawhid_send(packet) <= 0)
+		return false;
+	packet_number++;
+	return true;
+}
+
+static bool send_events(void) {
+	if (!send(events, TELEMETRY_EVENTS, events_count))
+		return false;
+	events_count = 0;
+	return true;
+}
+
+static bool send_stats(void) {
+	uint8_t packet[RAWHID_TX_SIZE] = {0};
+	uint8_t * p = packet + HEADER_SIZE;
+
+	uint16_t stats[TELEMETRY_STATS_COUNT] = {
+		[TELEMETRY_STAT_TIME]               = timer_get_ms(),
+		[TELEMETRY_STAT_SCANS]              = scans,
+		[TELEMETRY_STAT_EVENTS]             = events_total,
+		[TELEMETRY_STAT_EVENTS_LOST]        = events_lost,
+		[TELEMETRY_STAT_SCHED_MISSES]       = sched_misses,
+		[TELEMETRY_STAT_REPORTS_SUPPRESSED] = keyboard_reports_suppressed,
+		[TELEMETRY_STAT_REPORTS_DROPPED]    = keyboard_reports_dropped,
+		[TELEMETRY_STAT_REPORTS_RETRIED]    = keyboard_reports_retried,
+		[TELEMETRY_STAT_REPORTS_WAITING]    = (uint8_t)( keyboard_report_seq
+		                                      - keyboard_report_seq_sent ),
+		[TELEMETRY_STAT_INTERMEDIATE]       = mods_intermediate_reports,
+	};
+	for (uint8_t i=0; i<TELEMETRY_STATS_COUNT; i++, p+=2)
+		put16(p, stats[i]);
+
+	return send(packet, TELEMETRY_STATS, TELEMETRY_STATS_COUNT);
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * To be called once per matrix scan
+ */
+void telemetry_scan(void) {
+	scans++;
+}
+
+/*
+ * Add a key event to the packet being filled
+ *
+ * Arguments
+ * - position: which key (e.g. `row * KB_COLUMNS + col`); less than 128
+ * - time: when the key changed (in ms, as from `timer_get_ms()`)
+ *
+ * Note
+ * - If the packet is full, or the event is too long after the first one in
+ *   it to fit, the packet is sent first; if that can't be done right now, the
+ *   event is lost.
+ */
+void telemetry_key_event(uint8_t position, bool pressed, uint16_t time) {
+	events_total++;
+
+	if ( events_count && ( events_count == MAX_EVENTS
+	                       || timer_elapsed(events_time, time) > 0xFF )
+	     && !send_events() ) {
+		events_lost++;
+		return;
+	}
+
+	if (!events_count) {
+		events_time = time;
+		put16(events + HEADER_SIZE, time);
+	}
+	uint8_t * p = events + HEADER_SIZE + 2 + 2*events_count++;
+	p[0] = timer_elapsed(events_time, time);
+	p[1] = (pressed ? 0x80 : 0) | (position & 0x7F);
+}
+
+/*
+ * Send the packet being filled once its first event is `TELEMETRY_BATCH_TIME`
+ * old, and the stats every `TELEMETRY_STATS_PERIOD`
+ *
+ * Note
+ * - Meant to be run by the scheduler, every ms or two.  Anything that can't
+ *   be sent is tried again next time.
+ */
+void telemetry_task(void) {
+	uint16_t now = timer_get_ms();
+
+	if ( events_count
+	     && timer_elapsed(events_time, now) >= TELEMETRY_BATCH_TIME
+	     && !send_events() )
+		return;
+
+	if ( timer_elapsed(stats_time, now) >= TELEMETRY_STATS_PERIOD
+	     && send_stats() )
+		stats_time = now;
+}
+
@@ -0,0 +1,70 @@
+/* ----------------------------------------------------------------------------
+ * telemetry : exports
+ *
+ * Key events (with timestamps) and counters from around the firmware,
+ * streamed to the host in 64 byte packets over the raw HID interface (see
+ * "build-scripts/telemetry.py" for a reader).  Sending never waits: events
+ * are batched until a packet is full or the first of them is
+ * `TELEMETRY_BATCH_TIME` old, and if the host is slow to take packets, new
+ * events are dropped (and counted) instead of holding anything up.
+ * ----------------------------------------------------------------------------
+ * Packets (multi-byte values are little endian)
+ * - byte 0: `TELEMETRY_VERSION`
+ * - byte 1: `TELEMETRY_EVENTS` or `TELEMETRY_STATS`
+ * - byte 2: packet number (one more than the packet before it, so the host
+ *   can tell when it missed some)
+ * - byte 3: how many events, or how many stats
+ * - events, from byte 4: the time (in ms, as from `timer_get_ms()`) of the
+ *   first event; then 2 bytes for each event: its time since the first, and
+ *   `pressed << 7 | position`
+ * - stats, from byte 4: a 16 bit value for each of `TELEMETRY_STAT_*`, in
+ *   order.  Counters are totals since reset, so the host takes differences.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef LIB__TELEMETRY_h
+	#define LIB__TELEMETRY_h
+
+	#include <stdbool.h>
+	#include <stdint.h>
+
+	// --------------------------------------------------------------------
+
+	#ifndef TELEMETRY_BATCH_TIME
+		#define TELEMETRY_BATCH_TIME 10  // in ms; at most 255
+	#endif
+	#ifndef TELEMETRY_STATS_PERIOD
+		#define TELEMETRY_STATS_PERIOD 1000  // in ms
+	#endif
+
+	#define TELEMETRY_VERSION  1
+
+	#define TELEMETRY_EVENTS  1
+	#define TELEMETRY_STATS   2
+
+	enum telemetry_stats {
+		TELEMETRY_STAT_TIME,                // ms, when the packet was made
+		TELEMETRY_STAT_SCANS,
+		TELEMETRY_STAT_EVENTS,
+		TELEMETRY_STAT_EVENTS_LOST,         // not sent (see above)
+		TELEMETRY_STAT_SCHED_MISSES,        // see "scheduler.h"
+		TELEMETRY_STAT_REPORTS_SUPPRESSED,  // see "usb_keyboard_rawhid.c"
+		TELEMETRY_STAT_REPORTS_DROPPED,
+		TELEMETRY_STAT_REPORTS_RETRIED,
+		TELEMETRY_STAT_REPORTS_WAITING,     // accepted, but not yet sent
+		TELEMETRY_STAT_INTERMEDIATE,        // see "modifiers.h"
+		TELEMETRY_STATS_COUNT,
+	};
+
+	// --------------------------------------------------------------------
+
+	void telemetry_scan      (void);
+	void telemetry_key_event (uint8_t position, bool pressed, uint16_t time);
+	void telemetry_task      (void);
+
+#endif
+
@@ -0,0 +1,67 @@
+/* ----------------------------------------------------------------------------
+ * Very simple Teensy 2.0 millisecond timer : code
+ *
+ * - Timer/Counter0 in CTC mode, interrupting once per millisecond.  Timer1 is
+ *   used for the LED PWM (see "keyboard/ergodox/controller/teensy-2-0.c"), so
+ *   we leave it alone.
+ * - See the datasheet, section 13.7.2 ("Clear Timer on Compare Match (CTC)
+ *   Mode") and section 13.8 ("Register Description")
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+// ----------------------------------------------------------------------------
+// conditional compile
+#if MAKEFILE_BOARD == teensy-2-0
+// ----------------------------------------------------------------------------
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "./teensy-2-0.h"
+
+// ----------------------------------------------------------------------------
+
+#if F_CPU != 16000000
+	#error "Expecting different CPU frequency"
+#endif
+
+// 16MHz / 64 (prescaler) / 250 (OCR0A + 1) = 1kHz
+#define  TIMER0_PRESCALE_64  ((1<<CS01)|(1<<CS00))
+#define  TIMER0_TOP          249
+
+static volatile uint16_t timer_ms;
+
+// ----------------------------------------------------------------------------
+
+void timer_init(void) {
+	TCCR0A = (1<<WGM01);  // CTC mode, TOP = OCR0A
+	TCCR0B = TIMER0_PRESCALE_64;
+	OCR0A  = TIMER0_TOP;
+	TIMSK0 = (1<<OCIE0A); // interrupt on compare match
+}
+
+/*
+ * Returns
+ * - the number of milliseconds since `timer_init()`, modulo 2^16
+ */
+uint16_t timer_get_ms(void) {
+	uint8_t intr_state = SREG;
+	cli();
+	uint16_t ms = timer_ms;
+	SREG = intr_state;
+	return ms;
+}
+
+ISR(TIMER0_COMPA_vect) {
+	timer_ms++;
+}
+
+
+// ----------------------------------------------------------------------------
+#endif
+// ----------------------------------------------------------------------------
+
@@ -0,0 +1,32 @@
+/* ----------------------------------------------------------------------------
+ * Very simple Teensy 2.0 millisecond timer : exports
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef TIMER_h
+	#define TIMER_h
+
+	#include <stdbool.h>
+	#include <stdint.h>
+
+	// --------------------------------------------------------------------
+
+	void     timer_init   (void);
+	uint16_t timer_get_ms (void);
+
+	// --------------------------------------------------------------------
+
+	/*
+	 * Compare two timestamps from `timer_get_ms()`, correctly across
+	 * wraparound (as long as they are less than ~32 seconds apart)
+	 */
+	#define timer_elapsed(since, now)  ((uint16_t)((now) - (since)))
+	#define timer_reached(deadline, now)  \
+		((int16_t)((uint16_t)(now) - (uint16_t)(deadline)) >= 0)
+
+#endif
+
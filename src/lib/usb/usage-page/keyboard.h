@@ -277,6 +277,10 @@
 #define MEDIAKEY_AUDIO_MUTE     0x04
 #define MEDIAKEY_AUDIO_VOL_UP   0x05
 #define MEDIAKEY_AUDIO_VOL_DOWN 0x06
+// (these go in the system control report, rather than the consumer one)
+#define MEDIAKEY_SYSTEM_POWER_DOWN 0x07
+#define MEDIAKEY_SYSTEM_SLEEP      0x08
+#define MEDIAKEY_SYSTEM_WAKE_UP    0x09
 
 
 // ----------------------------------------------------------------------------
@@ -14,6 +14,15 @@
 #include "usb_keyboard_rawhid.h"
 //#include "./lib-other/pjrc/usb_keyboard/usb_keyboard.h"
 #include "./lib/key-functions/public.h"
+#include "./lib/key-functions/private.h"
+#include "./lib/usb/usage-page/keyboard.h"
+#include "./lib/debug.h"
+#include "./lib/eeprom-queue.h"
+#include "./lib/keymap.h"
+#include "./lib/modifiers.h"
+#include "./lib/scheduler.h"
+#include "./lib/telemetry.h"
+#include "./lib/timer.h"
 #include "./keyboard/controller.h"
 #include "./keyboard/layout.h"
 #include "./keyboard/matrix.h"
@@ -22,7 +31,7 @@
 #include <avr/pgmspace.h>
 
 #undef KB_LAYERS
-#define KB_LAYERS   5
+#define KB_LAYERS   4
 #define KB_ROWS     6
 #define KB_COLUMNS 14
 
@@ -37,6 +46,47 @@
 #define MRAL 0xE6
 #define MRGU 0xE7
 
+// Keycodes 0xE8 and up are not used by HID; in `custom_layout` they select an
+// action instead, with the high byte as its argument
+#define ACTION(kind, arg)  ( ((uint16_t)(arg) << 8) | (kind) )
+#define ACTION_TAP_HOLD  0xE8  // arg: index into `tap_holds`
+#define ACTION_LAYER     0xE9  // arg: layer to use while held
+#define ACTION_TAP_DANCE 0xEA  // arg: index into `tap_dances`
+#define ACTION_LEADER    0xEB  // starts a sequence from `leader_trie`
+#define ACTION_MEDIA     0xEC  // arg: `MEDIAKEY_*`
+#define ACTION_LOCK      0xED  // arg: layer to lock (or unlock)
+#define ACTION_BOOT      0xEE  // jumps to the bootloader
+#define ACTION_OS_MOD    0xEF  // arg: one-shot modifiers (as a mask)
+#define ACTION_OS_LAYER  0xF0  // arg: one-shot layer
+#define ACTION_DYN_MACRO 0xF1  // arg: 0 to record (or stop), 1 to play
+#define ACTION_MACRO     0xF2  // arg: index into `macros`
+#define ACTION_TEXT      0xF3  // arg: index into `texts`
+#define ACTION_UNICODE   0xF4  // arg: index into `unicode_texts`
+#define ACTION_UC_MODE   0xF5  // arg: `KBFUN_UNICODE_*`
+#define ACTION_AUTOSHIFT 0xF6  // toggles auto-shift
+#define ACTION_CAPS_WORD 0xF7  // toggles caps word
+#define ACTION_KBFUN     0xF8  // runs the key's function from the keyboard
+                               // layout (see `main_exec_key()`)
+
+#define TH(index)  ACTION(ACTION_TAP_HOLD, index)
+#define LY(layer)  ACTION(ACTION_LAYER, layer)
+#define TD(index)  ACTION(ACTION_TAP_DANCE, index)
+#define LEAD       ACTION(ACTION_LEADER, 0)
+#define MD(key)    ACTION(ACTION_MEDIA, key)
+#define LK(layer)  ACTION(ACTION_LOCK, layer)
+#define BOOT       ACTION(ACTION_BOOT, 0)
+#define OSM(mask)  ACTION(ACTION_OS_MOD, mask)
+#define OSL(layer) ACTION(ACTION_OS_LAYER, layer)
+#define DM_REC     ACTION(ACTION_DYN_MACRO, 0)
+#define DM_PLAY    ACTION(ACTION_DYN_MACRO, 1)
+#define MACRO(index) ACTION(ACTION_MACRO, index)
+#define TEXT(index)  ACTION(ACTION_TEXT, index)
+#define UC(index)    ACTION(ACTION_UNICODE, index)
+#define UCM(mode)    ACTION(ACTION_UC_MODE, mode)
+#define AS_TOGGLE    ACTION(ACTION_AUTOSHIFT, 0)
+#define CW_TOGGLE    ACTION(ACTION_CAPS_WORD, 0)
+#define KF           ACTION(ACTION_KBFUN, 0)
+
 // Previous ones after MLGU: 0x35, 0x64, 0x5C, 0x5E
 //     5  6  7 8
 //        4  9
@@ -63,13 +113,6 @@ const uint16_t PROGMEM custom_layout[KB_LAYERS][KB_ROWS][KB_COLUMNS] = {
      {  MLGU, 0x0065, 0x002E, 0x0035, 0x0064,      0,      0,           0,      0, 0x0050, 0x0051, 0x0052, 0x004F,   MRGU },
      {     0, 0x004D, 0x004C, 0x002A, 0x004A,   MLCT,   MLAL,        MRAL,   MRCT, 0x004B, 0x002C, 0x0028, 0x004E,      0 }},
 
-    {{0x0029, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x002E,      0x0000, 0x003F, 0x0040, 0x0041, 0x0042, 0x0043, 0x002D },
-     {0x002B, 0x201E, 0x201F, 0x2020, 0x2021, 0x2022, 0x0044,      0x0045, 0x401E, 0x401F, 0x4020, 0x4021, 0x4022, 0x0030 },
-     {0x0031, 0x2023, 0x2024, 0x2025, 0x2026, 0x2027,      0,           0, 0x4023, 0x4024, 0x4025, 0x4026, 0x4027, 0x0034 },
-     {  MLSH, 0x001D, 0x001B, 0x0006, 0x0019, 0x0005, 0x0000,      0x0000, 0x0011, 0x0010, 0x0036, 0x0037, 0x0038,   MRSH },
-     {0x043B, 0x0065, 0x002E, 0x0035, 0x0064,      0,      0,           0,      0, 0x0550, 0x042B, 0x062B, 0x054F, 0x043D },
-     {     0, 0x004D, 0x004C, 0x002A, 0x004A,   MLCT,   MLAL,        MRAL,   MRCT, 0x004B, 0x002C, 0x0028, 0x004E,      0 }},
-
     {{0x0029, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x002E,      0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x002D },
      {0x002B, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x4025,      0x002F, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x0030 },
      {0x0031, 0x003F, 0x0040, 0x0041, 0x0042, 0x0043,      0,           0, 0x003F, 0x0040, 0x0041, 0x0042, 0x0043, 0x0034 },
@@ -78,6 +121,187 @@ const uint16_t PROGMEM custom_layout[KB_LAYERS][KB_ROWS][KB_COLUMNS] = {
      {     0, 0x004D, 0x004C, 0x002A, 0x004A,   MLCT,   MLAL,        MRAL,   MRCT, 0x004B, 0x002C, 0x0028, 0x004E,      0 }}
 };
 
+// Key overrides: `keycode`, pressed while any of `mods` are held, acts as
+// `action` (an entry as in `custom_layout`, whose modifier override applies
+// as if `mods` weren't held), so that shifted (etc.) symbols don't need a
+// layer of their own.  Sorted by keycode.
+typedef struct {
+    uint8_t  keycode;
+    uint8_t  mods;
+    uint16_t action;
+} key_override_t;
+
+const key_override_t PROGMEM key_overrides[] = {
+    // keycode             mods  action
+    { KEY_Escape,          0x22, 0x0235            },  // shift+esc : ~
+    { KEY_DeleteBackspace, 0x22, KEY_DeleteForward },  // shift+bksp : del
+};
+
+#define KEY_OVERRIDE_COUNT  ( sizeof(key_overrides) / sizeof(key_override_t) )
+
+// Auto-shift: keys (by keycode) that are sent shifted when held for
+// `AUTO_SHIFT_TERM` ms (while auto-shift is on; see `AS_TOGGLE`).  A bitmap,
+// with keycode `k` at bit `k & 7` of byte `k >> 3`.
+const uint8_t PROGMEM auto_shift_keys[256/8] = {
+    0xF0,                    // 0x00 - 0x07 : a - d
+    0xFF, 0xFF, 0xFF,        // 0x08 - 0x1F : e - z, 1 - 2
+    0xFF,                    // 0x20 - 0x27 : 3 - 0
+    0xE0,                    // 0x28 - 0x2F : - = [
+    0xFB,                    // 0x30 - 0x37 : ] \ ; ' ` , .
+    0x01,                    // 0x38 - 0x3F : /
+};
+
+// Caps word: keys (by keycode, in a bitmap as above) that don't end a word.
+// While caps word is on (see `CW_TOGGLE`), letters and '-' are shifted, and
+// any other key ends it.
+const uint8_t PROGMEM caps_word_keys[256/8] = {
+    0xF0,                    // 0x00 - 0x07 : a - d
+    0xFF, 0xFF, 0xFF,        // 0x08 - 0x1F : e - z, 1 - 2
+    0xFF,                    // 0x20 - 0x27 : 3 - 0
+    0x24,                    // 0x28 - 0x2F : backspace -
+    0x00, 0x00, 0x00,
+    0x10,                    // 0x48 - 0x4F : delete
+};
+
+// held this long (in ms), an auto-shift key is shifted
+#define AUTO_SHIFT_TERM  MAKEFILE_AUTO_SHIFT_TERM
+
+// Dual role keys: `tap` if tapped, `hold` (a modifier or `LY()`) if held.
+// Put `TH(index)` in `custom_layout` to use one.
+typedef struct {
+    uint16_t tap;
+    uint16_t hold;
+} tap_hold_t;
+
+const tap_hold_t PROGMEM tap_holds[] = {
+    /* 0 */ { 0x0029, MLCT },  // escape / left control
+};
+
+// held longer than this (in ms), with nothing else happening, a dual role key
+// is held
+#define TAP_HOLD_TERM  MAKEFILE_TAP_HOLD_TERM
+// which modifiers may be pressed before a dual role key is known to be held
+// (ones that do nothing by themselves)
+#define TAP_HOLD_SPECULATIVE_MODS  0x33  // control and shift
+// how many key events can wait on a dual role key
+#define TAP_HOLD_BUFFER_SIZE  8
+
+// how long (in ms) a one-shot modifier or layer waits for a key, or 0 for as
+// long as it takes
+#define ONESHOT_TIMEOUT  MAKEFILE_ONESHOT_TIMEOUT
+
+// Tap dances: keys that act differently depending on how many times they are
+// tapped (see "lib/key-functions/public/tap-dance.c").  Actions may be
+// anything that could go in `custom_layout` except `TH()` and `TD()`.  Put
+// `TD(index)` in `custom_layout` to use one.
+const kbfun_tap_dance_t PROGMEM tap_dances[] = {
+    /* 0 */ { .tap = { 0x002F, 0x022F, 0x0226 } },  // [ / { / (
+};
+
+// Macros and strings, played at as many reports per second as the host will
+// take (see "lib/key-functions/public/macro.c").  Macros are keycodes to tap,
+// with `KBFUN_MACRO_*()` ops between them; strings are typed as on a US
+// layout.  Put `MACRO(index)` or `TEXT(index)` in `custom_layout` to use one.
+const uint8_t PROGMEM macro_select_line[] = {
+    KEY_Home, KBFUN_MACRO_MODS(0x02), KEY_End, KBFUN_MACRO_END,
+};
+const char PROGMEM text_signature[] = "-- \n";
+
+const uint8_t * const PROGMEM macros[] = {
+    /* 0 */ macro_select_line,  // select the current line
+};
+const char * const PROGMEM texts[] = {
+    /* 0 */ text_signature,
+};
+
+// Unicode strings (UTF-8), typed as code points through the host's input
+// method (set with `UCM(KBFUN_UNICODE_*)`; see
+// "lib/key-functions/public/unicode.c").  Put `UC(index)` in `custom_layout`
+// to use one.
+const char PROGMEM unicode_arrow[]  = "\u2192";
+const char PROGMEM unicode_shrug[]  = "\u00AF\\_(\u30C4)_/\u00AF";
+
+const char * const PROGMEM unicode_texts[] = {
+    /* 0 */ unicode_arrow,
+    /* 1 */ unicode_shrug,
+};
+
+// Leader sequences: after `LEAD`, keys (by keycode) walk down this trie, one
+// node per key, and the action at the end of the path is sent (see
+// "lib/key-functions/public/leader.c").  Each node lists its first child and
+// next sibling; node 0 is the root.  Put `LEAD` in `custom_layout` to use it.
+enum leader_nodes {
+    LD_ROOT,
+    LD_B, LD_BO, LD_BOO, LD_BOOT,
+    LD_M, LD_MP, LD_MN, LD_MM,
+    LD_L, LD_L2, LD_L4,
+    LD_T,
+};
+
+const kbfun_leader_node_t PROGMEM leader_trie[] = {
+    //           keycode        child    sibling  action
+    [LD_ROOT] = { 0,            LD_B,    0,       0                       },
+
+    [LD_B]    = { KEY_b_B,      LD_BO,   LD_M,    0                       },
+    [LD_BO]   = { KEY_o_O,      LD_BOO,  0,       0                       },
+    [LD_BOO]  = { KEY_o_O,      LD_BOOT, 0,       0                       },
+    [LD_BOOT] = { KEY_t_T,      0,       0,       BOOT                    },
+
+    [LD_M]    = { KEY_m_M,      LD_MP,   LD_L,    0                       },
+    [LD_MP]   = { KEY_p_P,      0,       LD_MN,   MD(MEDIAKEY_PLAY_PAUSE) },
+    [LD_MN]   = { KEY_n_N,      0,       LD_MM,   MD(MEDIAKEY_NEXT_TRACK) },
+    [LD_MM]   = { KEY_m_M,      0,       0,       MD(MEDIAKEY_AUDIO_MUTE) },
+
+    [LD_L]    = { KEY_l_L,      LD_L2,   LD_T,    0                       },
+    [LD_L2]   = { KEY_2_At,     0,       LD_L4,   LK(2)                   },
+    [LD_L4]   = { KEY_4_Dollar, 0,       0,       LK(3)                   },
+
+    [LD_T]    = { KEY_t_T,      0,       0,       0x0317  /* C-S-t */     },
+};
+
+// Combos: keys pressed together (within `COMBO_TERM`) that act as `action`
+// (any entry that could go in `custom_layout`, except `TH()`, and `KF`, which
+// would run the first key's function) instead.  Keys are matrix positions, as
+// in "keyboard/ergodox/matrix.h", so a combo works the same on every layer.
+#define COMBO_POSITION(row, col)  ( (row) * KB_COLUMNS + (col) )
+#define COMBO_NO_KEY  0xFF
+#define COMBO_BYTES   ( (KB_ROWS * KB_COLUMNS + 7) / 8 )
+#define COMBO_KEYS_MAX  4
+
+typedef struct {
+    uint8_t  keys[COMBO_BYTES];  // bit `COMBO_POSITION()` set for each key
+    uint8_t  count;              // number of keys
+    uint16_t action;
+} combo_t;
+
+#define _COMBO_BIT(i, p)  ( ((p) >> 3) == (i) ? 1 << ((p) & 7) : 0 )
+#define _COMBO_BYTE(i, a, b, c, d)  \
+    ( _COMBO_BIT(i, a) | _COMBO_BIT(i, b) | _COMBO_BIT(i, c) | _COMBO_BIT(i, d) )
+#define COMBO(action, a, b, c, d)  {                                          \
+    { _COMBO_BYTE( 0, a, b, c, d), _COMBO_BYTE( 1, a, b, c, d),               \
+      _COMBO_BYTE( 2, a, b, c, d), _COMBO_BYTE( 3, a, b, c, d),               \
+      _COMBO_BYTE( 4, a, b, c, d), _COMBO_BYTE( 5, a, b, c, d),               \
+      _COMBO_BYTE( 6, a, b, c, d), _COMBO_BYTE( 7, a, b, c, d),               \
+      _COMBO_BYTE( 8, a, b, c, d), _COMBO_BYTE( 9, a, b, c, d),               \
+      _COMBO_BYTE(10, a, b, c, d) },                                          \
+    ((a) != COMBO_NO_KEY) + ((b) != COMBO_NO_KEY)                             \
+      + ((c) != COMBO_NO_KEY) + ((d) != COMBO_NO_KEY),                        \
+    (action) }
+#define COMBO2(action, a, b)     COMBO(action, a, b, COMBO_NO_KEY, COMBO_NO_KEY)
+#define COMBO3(action, a, b, c)  COMBO(action, a, b, c, COMBO_NO_KEY)
+
+const combo_t PROGMEM combos[] = {
+    // home + end (left thumb) : caps lock
+    COMBO2( 0x0039, COMBO_POSITION(0, 4), COMBO_POSITION(0, 1) ),
+};
+
+#define COMBO_COUNT  ( sizeof(combos) / sizeof(combo_t) )
+// how close together (in ms) the keys of a combo have to be pressed
+#define COMBO_TERM  MAKEFILE_COMBO_TERM
+// how many combos can be held down at once (the keys of another one, pressed
+// while they are, go through as plain keys)
+#define COMBO_FIRED_MAX  2
+
 // ----------------------------------------------------------------------------
 
 #define  MAX_ACTIVE_LAYERS  20
@@ -90,44 +314,989 @@ bool (*main_kb_is_pressed)[KB_ROWS][KB_COLUMNS] = &_main_kb_is_pressed;
 static bool _main_kb_was_pressed[KB_ROWS][KB_COLUMNS];
 bool (*main_kb_was_pressed)[KB_ROWS][KB_COLUMNS] = &_main_kb_was_pressed;
 
-// Idea is that the same key is interpreted as the same from press down to up.
-uint8_t kb_history[KB_ROWS][KB_COLUMNS];
-
-// static bool main_kb_was_transparent[KB_ROWS][KB_COLUMNS];
-//
-//
+// the state of each key as far as `main_task_process()` has handled it (which
+// lags the matrix while events are held back, see `main_events_blocked()`)
+static bool main_kb_processed[KB_ROWS][KB_COLUMNS];
 
-// uint8_t main_layers_pressed[KB_ROWS][KB_COLUMNS];
+// Idea is that the same key is interpreted as the same from press down to up.
+uint16_t kb_history[KB_ROWS][KB_COLUMNS];
 
-uint8_t main_loop_row;
-uint8_t main_loop_col;
+// for `KF` keys: the layer (of the key function layer stack) each was
+// pressed on, and whether it was reached through a transparent key, so the
+// release runs the same function
+uint8_t     main_layers_pressed[KB_ROWS][KB_COLUMNS];
+static bool main_kb_was_transparent[KB_ROWS][KB_COLUMNS];
 
-uint8_t main_arg_layer;
-uint8_t main_arg_layer_offset;
-uint8_t main_arg_row;
-uint8_t main_arg_col;
-bool    main_arg_is_pressed;
-bool    main_arg_was_pressed;
-bool    main_arg_any_non_trans_key_pressed;
-bool    main_arg_trans_key_pressed;
+// the event being executed by `main_exec_key()` (see "main.h")
+key_event_t * main_arg;
+bool          main_any_non_trans_key_pressed;
 
 // 
 uint8_t main_l_mode;
 uint8_t main_r_mode;
-uint8_t main_key_modifiers;
-uint8_t main_direct_modifiers;
+
+// the layer selected by `main_l_mode` and the layer keys, as of the last scan
+static uint8_t main_mode;
+// the layer held with `LY()`, or 0
+static uint8_t main_layer_held;
+
+// whether auto-shift is on (see `main_auto_shift_eligible()`)
+static bool main_auto_shift_on;
+
+// whether caps word is on (see `main_caps_word()`)
+static bool main_caps_word_on;
+
+// the one-shot layer (see `main_oneshot_layer_press()`)
+static StickyState main_oneshot_state;
+static uint8_t     main_oneshot_layer;
+static bool        main_oneshot_used;
+static uint16_t    main_oneshot_time;
+
+// ----------------------------------------------------------------------------
+
+static uint8_t main_layer(void) {
+    if (main_layer_held)
+        return main_layer_held;
+    if (main_oneshot_state != eStickyNone)
+        return main_oneshot_layer;
+    return main_mode;
+}
+
+/*
+ * One-shot layers
+ *
+ * Note
+ * - Like one-shot modifiers (see "lib/modifiers.c"), using the same states: a
+ *   one-shot layer applies to the next key pressed (or to all keys pressed
+ *   while it is held), is locked by tapping it again while it waits, and
+ *   dropped after `ONESHOT_TIMEOUT` ms (if that's not 0)
+ */
+static void main_oneshot_layer_press(uint8_t layer) {
+    if (main_oneshot_state == eStickyOnceUp && main_oneshot_layer == layer) {
+        main_oneshot_state = eStickyLock;
+    } else if (main_oneshot_state == eStickyLock && main_oneshot_layer == layer) {
+        main_oneshot_state = eStickyNone;
+    } else {
+        main_oneshot_state = eStickyOnceDown;
+        main_oneshot_layer = layer;
+        main_oneshot_used  = false;
+    }
+}
+static void main_oneshot_layer_release(uint8_t layer) {
+    if (main_oneshot_state != eStickyOnceDown || main_oneshot_layer != layer)
+        return;
+
+    main_oneshot_state = main_oneshot_used ? eStickyNone : eStickyOnceUp;
+    main_oneshot_time  = timer_get_ms();
+}
+static void main_oneshot_layer_use(void) {
+    if (main_oneshot_state == eStickyOnceUp)
+        main_oneshot_state = eStickyNone;
+    else if (main_oneshot_state == eStickyOnceDown)
+        main_oneshot_used = true;
+}
+static void main_oneshot_tick(uint16_t now) {
+    mods_oneshot_tick(now);
+
+    if ( ONESHOT_TIMEOUT && main_oneshot_state == eStickyOnceUp
+         && timer_elapsed(main_oneshot_time, now) >= ONESHOT_TIMEOUT )
+        main_oneshot_state = eStickyNone;
+}
+
+/*
+ * Caps word: the modifier override for (non-modifier) key `c`, pressed with
+ * override `h`
+ *
+ * Note
+ * - Shift goes into the override of the keys it applies to, like one-shot
+ *   modifiers, so turning caps word on or off never sends a report by itself
+ * - Whether a key ends the word is one lookup, in `caps_word_keys`
+ */
+static uint8_t main_caps_word(uint8_t c, uint8_t h) {
+    if (!main_caps_word_on)
+        return h;
+
+    if ( !( pgm_read_byte(&caps_word_keys[c >> 3]) & (1 << (c & 7)) )
+         || (mods_get_direct() & ~0x22) ) {
+        main_caps_word_on = false;  // not part of a word, or a shortcut
+        return h;
+    }
+
+    if ((c >= KEY_a_A && c <= KEY_z_Z) || c == KEY_Dash_Underscore)
+        h |= 0x02 & ~mods_get_direct();
+    return h;
+}
+
+/*
+ * Look up the entry for a key (in `custom_layout`, as edited over raw HID;
+ * see "lib/keymap.h")
+ */
+static uint16_t main_lookup(uint8_t layer, uint8_t row, uint8_t col) {
+    return keymap_get( ((uint16_t)layer * KB_ROWS + (KB_ROWS - 1 - row))
+                       * KB_COLUMNS + col );
+}
+
+/*
+ * Press or release `kc` (an entry from `custom_layout`)
+ *
+ * Note
+ * - Exported so key functions that decide what to send themselves (such as
+ *   tap dances) can send it
+ */
+void main_action_press(uint16_t kc) {
+    uint8_t h = (kc >> 8);
+    uint8_t c = (kc & 255);
+
+    if (c == 0)
+        return;
+    if (c == ACTION_LAYER)
+        main_layer_held = h;
+    else if (c == ACTION_MEDIA)
+        _kbfun_mediakey_press_release(true, h);
+    else if (c == ACTION_LOCK)
+        main_l_mode = (main_l_mode == h) ? 0 : h;
+    else if (c == ACTION_BOOT)
+        kbfun_jump_to_bootloader(NULL);
+    else if (c == ACTION_OS_MOD)
+        mods_oneshot_press(h);
+    else if (c == ACTION_OS_LAYER)
+        main_oneshot_layer_press(h);
+    else if (c == ACTION_DYN_MACRO && h)
+        kbfun_dynamic_macro_play();
+    else if (c == ACTION_DYN_MACRO)
+        kbfun_dynamic_macro_record();
+    else if (c == ACTION_MACRO)
+        kbfun_macro_play((const uint8_t *) pgm_read_word(&macros[h]));
+    else if (c == ACTION_TEXT)
+        kbfun_macro_type((const char *) pgm_read_word(&texts[h]));
+    else if (c == ACTION_UNICODE)
+        kbfun_macro_type_unicode(
+                (const char *) pgm_read_word(&unicode_texts[h]) );
+    else if (c == ACTION_UC_MODE)
+        kbfun_unicode_set_mode(h);
+    else if (c == ACTION_AUTOSHIFT)
+        main_auto_shift_on = !main_auto_shift_on;
+    else if (c == ACTION_CAPS_WORD)
+        main_caps_word_on = !main_caps_word_on;
+    else if (c >= 0xE8)
+        return;
+    else if ((c & 0xF8) == 0xE0)
+        mods_press_mod(1 << (c & 7));
+    else
+        mods_press_key(c, main_caps_word(c, h));
+
+    if (c < 0xE8)
+        kbfun_dynamic_macro_event(kc, true);
+}
+void main_action_release(uint16_t kc) {
+    uint8_t h = (kc >> 8);
+    uint8_t c = (kc & 255);
+
+    if (c == 0)
+        return;
+    if (c == ACTION_LAYER)
+        main_layer_held = 0;
+    else if (c == ACTION_MEDIA)
+        _kbfun_mediakey_press_release(false, h);
+    else if (c == ACTION_OS_MOD)
+        mods_oneshot_release(h);
+    else if (c == ACTION_OS_LAYER)
+        main_oneshot_layer_release(h);
+    else if (c >= 0xE8)
+        return;
+    else if ((c & 0xF8) == 0xE0)
+        mods_release_mod(1 << (c & 7));
+    else
+        mods_release_key(c);
+
+    if (c < 0xE8)
+        kbfun_dynamic_macro_event(kc, false);
+}
+
+/*
+ * Apply `key_overrides` to `kc` (an entry from `custom_layout`)
+ *
+ * Note
+ * - Most presses are decided before the table is looked at (no modifiers
+ *   held, or not a key); otherwise it's a binary search, by keycode
+ */
+static uint16_t main_key_override(uint16_t kc) {
+    uint8_t c      = (kc & 255);
+    uint8_t direct = mods_get_direct();
+
+    if (!direct || c >= 0xE0)
+        return kc;
+
+    uint8_t low  = 0;
+    uint8_t high = KEY_OVERRIDE_COUNT;
+    while (low < high) {
+        uint8_t middle  = (low + high) / 2;
+        uint8_t keycode = pgm_read_byte(&key_overrides[middle].keycode);
+
+        if (keycode < c) {
+            low = middle + 1;
+        } else if (keycode > c) {
+            high = middle;
+        } else {
+            // (there may be more than one entry for the keycode)
+            while ( middle
+                    && pgm_read_byte(&key_overrides[middle-1].keycode) == c )
+                middle--;
+            for (; middle < high; middle++) {
+                const key_override_t * o = &key_overrides[middle];
+                uint8_t mods = pgm_read_byte(&o->mods) & direct;
+
+                if (pgm_read_byte(&o->keycode) != c)
+                    break;
+                if (mods)
+                    return pgm_read_word(&o->action) ^ (mods << 8);
+            }
+            break;
+        }
+    }
+    return kc;
+}
+
+/*
+ * Press the key at (row, col) as `kc`, remembering it for the release
+ */
+static void main_press(uint8_t row, uint8_t col, uint16_t kc) {
+    kc = main_key_override(kc);
+    kb_history[row][col] = kc;
+    main_action_press(kc);
+}
+
+/*
+ * Release the key at (row, col) as whatever it was pressed as
+ */
+static void main_release(uint8_t row, uint8_t col) {
+    main_action_release(kb_history[row][col]);
+}
+
+/*
+ * Auto-shift
+ *
+ * Note
+ * - A press of an auto-shift key (with no modifiers) waits until either the
+ *   key is released, another key is pressed, or it has been held for
+ *   `AUTO_SHIFT_TERM`; only the last sends it shifted.  The last is caught
+ *   by a task armed for the exact ms (see `main_auto_shift_arm()`), not by
+ *   the next scan.  Other keys are not held up at all.
+ */
+static struct {
+    bool     pending;
+    uint8_t  row;
+    uint8_t  col;
+    uint16_t kc;
+    uint16_t time;
+} main_as;
+
+static void main_auto_shift_arm    (uint16_t time);
+static void main_auto_shift_disarm (void);
+
+static bool main_auto_shift_eligible(uint16_t kc) {
+    uint8_t c = (kc & 255);
+
+    return main_auto_shift_on && !(kc >> 8) && !mods_get_direct()
+           && ( pgm_read_byte(&auto_shift_keys[c >> 3]) & (1 << (c & 7)) );
+}
+
+static void main_auto_shift_decide(bool shifted) {
+    main_as.pending = false;
+    main_auto_shift_disarm();
+    // (with left shift as its modifier override, if shifted)
+    main_press( main_as.row, main_as.col,
+                shifted ? (main_as.kc | 0x0200) : main_as.kc );
+}
+
+/*
+ * Press `kc` (an entry from `custom_layout`) for `event`: the part of
+ * `main_process_key()` after the lookup, which fired combos go through too
+ */
+static void main_process_press(key_event_t * event, uint16_t kc) {
+    if (kbfun_leader_active())
+        kc = kbfun_leader_key(event, kc);
+
+    if ((kc & 255) == ACTION_LEADER) {
+        kb_history[event->row][event->col] = 0;
+        kbfun_leader_start(event, leader_trie);
+        return;
+    }
+
+    if ((kc & 255) == ACTION_TAP_DANCE) {
+        kb_history[event->row][event->col] = kc;
+        kbfun_tap_dance_press_release(event, &tap_dances[kc >> 8]);
+        return;
+    }
+
+    if ((kc & 255) == ACTION_KBFUN) {
+        kb_history[event->row][event->col] = kc;
+        event->layer = main_layers_peek(0);
+        event->layer_offset = 0;
+        event->trans = false;
+        main_layers_pressed[event->row][event->col] = event->layer;
+        main_exec_key(event);
+        main_kb_was_transparent[event->row][event->col] = event->trans;
+        return;
+    }
+
+    kbfun_tap_dance_interrupt(event);
+
+    if (main_auto_shift_eligible(kc)) {
+        main_as.pending = true;
+        main_as.row     = event->row;
+        main_as.col     = event->col;
+        main_as.kc      = kc;
+        main_as.time    = event->time;
+        main_auto_shift_arm(event->time + AUTO_SHIFT_TERM);
+        return;
+    }
+
+    main_press(event->row, event->col, kc);
+}
+
+/*
+ * Process a key press or release against `custom_layout`
+ */
+static void main_process_key(key_event_t * event) {
+    if (main_as.pending) {
+        if (event->pressed) {
+            main_auto_shift_decide(false);
+        } else if ( event->row == main_as.row && event->col == main_as.col ) {
+            main_auto_shift_decide(
+                    timer_elapsed(main_as.time, event->time)
+                    >= AUTO_SHIFT_TERM );
+        }
+    }
+
+    if (event->pressed) {
+        event->layer = main_layer();
+        uint16_t kc = main_lookup(event->layer, event->row, event->col);
+
+        if (main_oneshot_state != eStickyNone) {
+            // a one-shot layer key, from the layer the one-shot came from,
+            // still works as itself (so it can be tapped again to lock)
+            uint16_t base = main_lookup(main_mode, event->row, event->col);
+            if ((base & 255) == ACTION_OS_LAYER) {
+                event->layer = main_mode;
+                kc = base;
+            } else if ((kc & 255) < 0xE0 || (kc & 255) >= 0xE8) {
+                main_oneshot_layer_use();
+            }
+        }
+
+        main_process_press(event, kc);
+    } else {
+        uint16_t kc = kb_history[event->row][event->col];
+
+        if ((kc & 255) == ACTION_TAP_DANCE) {
+            kbfun_tap_dance_press_release(event, &tap_dances[kc >> 8]);
+            return;
+        }
+
+        if ((kc & 255) == ACTION_KBFUN) {
+            event->layer = main_layers_pressed[event->row][event->col];
+            event->layer_offset = 0;
+            event->trans = main_kb_was_transparent[event->row][event->col];
+            main_exec_key(event);
+            return;
+        }
+
+        main_release(event->row, event->col);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Combos
+ * ----------------------------------------------------------------------------
+ * Presses are held back only while some combo could still match them: the
+ * first press of a key that is in a combo makes every combo with that key a
+ * candidate, and each press after it drops the candidates without that key,
+ * so only the remaining candidates are ever looked at.  As soon as there are
+ * no candidates left the held back presses go through as normal keys; when
+ * all the candidates left are complete, the combo fires at once.  Waiting
+ * stops (with the largest complete combo, if any) when one of the held back
+ * keys is released, or after `COMBO_TERM`.
+ *
+ * A combo's action is pressed as if it were the entry in `custom_layout` at
+ * the position of its first key, so it goes through the same stages (layers,
+ * one-shots, leader sequences, auto-shift) as any other, and released when
+ * the first of its keys is released.
+ * ------------------------------------------------------------------------- */
+
+static uint8_t     main_combo_candidates[(COMBO_COUNT + 7) / 8];
+static key_event_t main_combo_buffer[COMBO_KEYS_MAX];
+static uint8_t     main_combo_buffered;
+
+// keys that are part of a fired combo, and not yet released
+static uint8_t main_combo_held[COMBO_BYTES];
+
+static struct {
+    bool    active;
+    uint8_t index;
+    uint8_t row;
+    uint8_t col;
+} main_combo_fired[COMBO_FIRED_MAX];
+
+#define BIT_GET(array, i)    ( (array)[(i) >> 3] &   (1 << ((i) & 7)) )
+#define BIT_SET(array, i)    ( (array)[(i) >> 3] |=  (1 << ((i) & 7)) )
+#define BIT_CLEAR(array, i)  ( (array)[(i) >> 3] &= ~(1 << ((i) & 7)) )
+
+static bool main_combo_has(uint8_t index, uint8_t position) {
+    return pgm_read_byte(&combos[index].keys[position >> 3])
+           & (1 << (position & 7));
+}
+
+/*
+ * Fire a combo with the held back presses
+ *
+ * Returns
+ * - `true` if it fired, or `false` if `COMBO_FIRED_MAX` combos are already
+ *   held down (and the presses are still waiting)
+ */
+static bool main_combo_fire(uint8_t index) {
+    uint8_t slot = 0;
+    while (slot < COMBO_FIRED_MAX && main_combo_fired[slot].active)
+        slot++;
+    if (slot == COMBO_FIRED_MAX)
+        return false;
+
+    key_event_t event = main_combo_buffer[0];
+
+    for (uint8_t i=0; i<main_combo_buffered; i++)
+        BIT_SET( main_combo_held, COMBO_POSITION( main_combo_buffer[i].row,
+                                                  main_combo_buffer[i].col ) );
+    main_combo_buffered = 0;
+
+    main_combo_fired[slot].active = true;
+    main_combo_fired[slot].index  = index;
+    main_combo_fired[slot].row    = event.row;
+    main_combo_fired[slot].col    = event.col;
+
+    // as `main_process_key()` would, for a key with this action
+    uint16_t kc = pgm_read_word(&combos[index].action);
+    if (main_as.pending)
+        main_auto_shift_decide(false);
+    event.layer = main_layer();
+    if ( main_oneshot_state != eStickyNone
+         && ((kc & 255) < 0xE0 || (kc & 255) >= 0xE8) )
+        main_oneshot_layer_use();
+    main_process_press(&event, kc);
+    return true;
+}
+
+/*
+ * Stop waiting: fire the largest complete candidate, or let the held back
+ * presses through
+ */
+static void main_combo_resolve(void) {
+    if (!main_combo_buffered)
+        return;
+
+    for (uint8_t i=0; i<COMBO_COUNT; i++) {
+        if ( BIT_GET(main_combo_candidates, i)
+             && pgm_read_byte(&combos[i].count) == main_combo_buffered ) {
+            if (main_combo_fire(i))
+                return;
+            break;  // too many held down: let the presses through instead
+        }
+    }
+
+    for (uint8_t i=0; i<main_combo_buffered; i++)
+        main_process_key(&main_combo_buffer[i]);
+    main_combo_buffered = 0;
+}
+
+static void main_combo_tick(uint16_t now) {
+    if ( main_combo_buffered
+         && timer_elapsed(main_combo_buffer[0].time, now) >= COMBO_TERM )
+        main_combo_resolve();
+}
+
+static void main_combo_event(key_event_t * event) {
+    uint8_t position = COMBO_POSITION(event->row, event->col);
+
+    if (!event->pressed) {
+        for (uint8_t i=0; i<main_combo_buffered; i++) {
+            if ( main_combo_buffer[i].row == event->row
+                 && main_combo_buffer[i].col == event->col ) {
+                main_combo_resolve();
+                break;
+            }
+        }
+
+        if (!BIT_GET(main_combo_held, position)) {
+            main_process_key(event);
+            return;
+        }
+
+        BIT_CLEAR(main_combo_held, position);
+        for (uint8_t i=0; i<COMBO_FIRED_MAX; i++) {
+            if ( main_combo_fired[i].active
+                 && main_combo_has(main_combo_fired[i].index, position) ) {
+                main_combo_fired[i].active = false;
+                key_event_t release = {
+                    .row     = main_combo_fired[i].row,
+                    .col     = main_combo_fired[i].col,
+                    .pressed = false,
+                    .time    = event->time,
+                };
+                main_process_key(&release);
+            }
+        }
+        return;
+    }
+
+    bool candidates   = false;  // are there any left
+    bool all_complete = true;   // are all of them complete
+
+    for (uint8_t i=0; i<COMBO_COUNT; i++) {
+        if (main_combo_buffered && !BIT_GET(main_combo_candidates, i))
+            continue;
+        if (main_combo_has(i, position)) {
+            candidates = true;
+            if (pgm_read_byte(&combos[i].count) != main_combo_buffered + 1)
+                all_complete = false;
+        }
+    }
+
+    if (!candidates) {
+        if (main_combo_buffered) {
+            // this press ends the wait (and came after the keys that were
+            // waiting, so mustn't share a report with them); it may start
+            // another one
+            main_combo_resolve();
+            mods_flush();
+            main_combo_event(event);
+        } else {
+            main_process_key(event);
+        }
+        return;
+    }
+
+    if (main_combo_buffered == COMBO_KEYS_MAX) {
+        main_combo_resolve();
+        main_combo_event(event);
+        return;
+    }
+
+    for (uint8_t i=0; i<COMBO_COUNT; i++) {
+        if (main_combo_buffered && !BIT_GET(main_combo_candidates, i))
+            continue;
+        if (main_combo_has(i, position))
+            BIT_SET(main_combo_candidates, i);
+        else
+            BIT_CLEAR(main_combo_candidates, i);
+    }
+    main_combo_buffer[main_combo_buffered++] = *event;
+
+    if (all_complete)
+        main_combo_resolve();
+}
+
+/* ----------------------------------------------------------------------------
+ * Dual role (tap/hold) keys
+ * ----------------------------------------------------------------------------
+ * While a dual role key is undecided, the events after it wait in a buffer.
+ * It is decided as soon as one of these happens, with no fixed delay:
+ * - it is released first: tap (even if other keys were pressed meanwhile,
+ *   as in a fast roll)
+ * - a key pressed after it is released first: hold
+ * - it has been down for `TAP_HOLD_TERM`: hold (caught by a task armed for
+ *   the exact ms, as for auto-shift, not by the next scan)
+ * and then the waiting events are replayed.  A tap is sent when the key is
+ * released, so taps are never later than a plain key's release would be.
+ *
+ * Modifiers in `TAP_HOLD_SPECULATIVE_MODS` are pressed as soon as the key
+ * goes down, so (for example) control-click works at once; they are let go
+ * again, before the tap, if it turns out to be one.
+ * ------------------------------------------------------------------------- */
+
+static struct {
+    bool        pending;
+    uint8_t     row;
+    uint8_t     col;
+    uint16_t    time;
+    tap_hold_t  action;
+    uint8_t     speculative;  // modifiers pressed ahead of time
+} main_th;
+
+// one more than `TAP_HOLD_BUFFER_SIZE`, for the event that decided the key, if
+// the ones before it can't all be replayed at once
+static key_event_t main_th_buffer[TAP_HOLD_BUFFER_SIZE + 1];
+static uint8_t     main_th_buffered;
+
+// how many reports the report queue must have room for before a key event is
+// handled: a press may need two (see `mods_press_key()`), ending a combo or
+// tap/hold wait one more, and the report at the end of the pass another
+#define MAIN_EVENT_REPORTS  4
+
+static bool main_report_room(void) {
+    return usb_keyboard_queued() < KEYBOARD_QUEUE_SIZE - MAIN_EVENT_REPORTS;
+}
+
+static void main_tap_hold_step   (key_event_t * event);
+static void main_tap_hold_event  (key_event_t * event);
+static void main_tap_hold_arm    (uint16_t time);
+static void main_tap_hold_disarm (void);
+
+/*
+ * Replay the events that were waiting on the dual role key, in order
+ *
+ * Note
+ * - If the report queue runs out of room, the rest are kept, and replayed
+ *   from `main_tap_hold_tick()` once it has drained.  New events are held
+ *   back meanwhile (see `main_events_blocked()`).
+ */
+static void main_tap_hold_replay(void) {
+    key_event_t buffer[TAP_HOLD_BUFFER_SIZE + 1];
+    uint8_t count = main_th_buffered;
+
+    for (uint8_t i=0; i<count; i++)
+        buffer[i] = main_th_buffer[i];
+    main_th_buffered = 0;
+
+    for (uint8_t i=0; i<count; i++) {
+        // (events only buffered behind another dual role key send nothing;
+        // a replay it started may have left some behind, and those go first)
+        if (!main_th.pending && (main_th_buffered || !main_report_room())) {
+            for (; i<count; i++)
+                main_th_buffer[main_th_buffered++] = buffer[i];
+            return;
+        }
+        main_tap_hold_step(&buffer[i]);
+    }
+}
+
+static void main_tap_hold_decide(bool hold) {
+    main_th.pending = false;
+    main_tap_hold_disarm();
+    main_combo_resolve();  // anything waiting there came first
+
+    if (hold) {
+        main_press(main_th.row, main_th.col, main_th.action.hold);
+        main_tap_hold_replay();
+    } else {
+        mods_release_mod(main_th.speculative);
+        main_press(main_th.row, main_th.col, main_th.action.tap);
+        // the tap came first; don't let the host see it alongside the keys
+        // that were waiting on it
+        if (main_th_buffered)
+            mods_flush();
+        main_tap_hold_replay();
+    }
+}
+
+/*
+ * Carry on replaying events that were waiting for room in the report queue
+ */
+static void main_tap_hold_tick(void) {
+    if (!main_th.pending && main_th_buffered)
+        main_tap_hold_replay();
+}
+
+static void main_tap_hold_step(key_event_t * event) {
+    if (!main_th.pending) {
+        uint16_t kc = main_lookup(main_layer(), event->row, event->col);
+
+        if (!event->pressed || (kc & 255) != ACTION_TAP_HOLD) {
+            main_combo_event(event);
+            return;
+        }
+
+        main_th.pending = true;
+        main_th.row     = event->row;
+        main_th.col     = event->col;
+        main_th.time    = event->time;
+        memcpy_P( &main_th.action, &tap_holds[kc >> 8],
+                  sizeof(tap_hold_t) );
+        main_tap_hold_arm(event->time + TAP_HOLD_TERM);
+
+        main_th.speculative = 0;
+        uint8_t c = main_th.action.hold & 255;
+        if ((c & 0xF8) == 0xE0) {
+            uint8_t mask = (1 << (c & 7));
+            if ( (mask & TAP_HOLD_SPECULATIVE_MODS)
+                 && !(mods_get_direct() & mask) ) {
+                main_th.speculative = mask;
+                mods_press_mod(mask);
+            }
+        }
+        return;
+    }
+
+    if (event->row == main_th.row && event->col == main_th.col) {
+        // released while undecided
+        main_tap_hold_decide(timer_elapsed(main_th.time, event->time)
+                             >= TAP_HOLD_TERM);
+        if (!main_th.pending && main_th_buffered)
+            main_th_buffer[main_th_buffered++] = *event;  // after the rest
+        else
+            main_release(event->row, event->col);
+        return;
+    }
+
+    if (!event->pressed) {
+        bool waiting = false;
+        for (uint8_t i=0; i<main_th_buffered; i++)
+            if ( main_th_buffer[i].row == event->row
+                 && main_th_buffer[i].col == event->col )
+                waiting = true;
+
+        if (!waiting) {
+            // pressed before the dual role key; nothing to wait for
+            main_combo_event(event);
+            return;
+        }
+    }
+
+    if (main_th_buffered >= TAP_HOLD_BUFFER_SIZE) {
+        // too much is happening for this to be a tap
+        main_tap_hold_decide(true);
+        main_tap_hold_event(event);
+        return;
+    }
+
+    main_th_buffer[main_th_buffered++] = *event;
+
+    // a key pressed after the dual role key was released before it: hold
+    if (!event->pressed)
+        main_tap_hold_decide(true);
+}
+
+static void main_tap_hold_event(key_event_t * event) {
+    if (!main_th.pending && main_th_buffered)
+        main_th_buffer[main_th_buffered++] = *event;  // after the rest
+    else
+        main_tap_hold_step(event);
+}
+
+/*
+ * Whether key events have to stay in the matrix until the next pass: when
+ * the report queue is too full for what they might send, or when earlier
+ * events are still waiting to be replayed
+ */
+static bool main_events_blocked(void) {
+    return !main_report_room() || (!main_th.pending && main_th_buffered);
+}
+
+/* ----------------------------------------------------------------------------
+ * Tasks
+ * ----------------------------------------------------------------------------
+ * The main loop is split into tasks, run by the scheduler in "lib/scheduler.h"
+ * in order of their deadlines.  Scanning is periodic; processing and sending
+ * reports are triggered by the task before them, so a key change reaches the
+ * host within a couple of ms of being scanned, whatever else is pending.
+ * ------------------------------------------------------------------------- */
+
+static void main_task_scan             (void);
+static void main_task_process          (void);
+static void main_task_keyboard_report  (void);
+static void main_task_extra_report     (void);
+static void main_task_leds             (void);
+static void main_task_auto_shift       (void);
+static void main_task_tap_hold         (void);
+static void main_task_rawhid           (void);
+
+enum main_task_ids {
+    MAIN_TASK_SCAN,
+    MAIN_TASK_PROCESS,
+    MAIN_TASK_KEYBOARD_REPORT,
+    MAIN_TASK_EXTRA_REPORT,
+    MAIN_TASK_LEDS,
+    MAIN_TASK_EEPROM,
+    MAIN_TASK_AUTO_SHIFT,
+    MAIN_TASK_TAP_HOLD,
+    MAIN_TASK_TELEMETRY,
+    MAIN_TASK_RAWHID,
+    MAIN_TASK_KEYMAP,
+    MAIN_TASKS,
+};
+
+static sched_task_t main_tasks[MAIN_TASKS] = {
+    [MAIN_TASK_SCAN]            = SCHED_PERIODIC(  &main_task_scan,
+                                                   MAKEFILE_DEBOUNCE_TIME, 1 ),
+    [MAIN_TASK_PROCESS]         = SCHED_TRIGGERED( &main_task_process, 1 ),
+    [MAIN_TASK_KEYBOARD_REPORT] = SCHED_TRIGGERED( &main_task_keyboard_report,
+                                                   1 ),
+    [MAIN_TASK_EXTRA_REPORT]    = SCHED_TRIGGERED( &main_task_extra_report, 4 ),
+    [MAIN_TASK_LEDS]            = SCHED_PERIODIC(  &main_task_leds, 10, 10 ),
+    [MAIN_TASK_EEPROM]          = SCHED_PERIODIC(  &eeprom_queue_task, 4, 50 ),
+    [MAIN_TASK_AUTO_SHIFT]      = SCHED_TRIGGERED( &main_task_auto_shift, 1 ),
+    [MAIN_TASK_TAP_HOLD]        = SCHED_TRIGGERED( &main_task_tap_hold, 1 ),
+    [MAIN_TASK_TELEMETRY]       = SCHED_PERIODIC(  &telemetry_task, 2, 10 ),
+    [MAIN_TASK_RAWHID]          = SCHED_PERIODIC(  &main_task_rawhid, 2, 10 ),
+    [MAIN_TASK_KEYMAP]          = SCHED_PERIODIC(  &keymap_task, 4, 50 ),
+};
+
+// when the matrix was last scanned
+static uint16_t main_scan_time;
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Scan the matrix
+ *
+ * Note
+ * - The period of this task is the debounce time, which used to be a
+ *   `_delay_ms()` at the end of the main loop
+ */
+static void main_task_scan(void) {
+    // swap `main_kb_is_pressed` and `main_kb_was_pressed`, then update
+    bool (*temp)[KB_ROWS][KB_COLUMNS] = main_kb_was_pressed;
+    main_kb_was_pressed = main_kb_is_pressed;
+    main_kb_is_pressed = temp;
+
+    kb_update_matrix(*main_kb_is_pressed);
+    main_scan_time = timer_get_ms();
+    telemetry_scan();
+
+    sched_trigger(&main_tasks[MAIN_TASK_PROCESS]);
+}
+
+/*
+ * Turn the changes in the last scan into key events
+ */
+static void main_task_process(void) {
+    main_mode = main_l_mode;
+
+    #define GOING_DOWN(row, col) ((*main_kb_is_pressed)[row][col] > (*main_kb_was_pressed)[row][col])
+    #define PRESSED(row, col) (*main_kb_is_pressed)[row][col]
+    if (GOING_DOWN(5, 7)) main_l_mode ^= 2;
+    if (PRESSED(2, 6)) main_mode = 1;
+    if (PRESSED(2, 7)) main_mode = 1;
+
+    main_tap_hold_tick();
+    main_combo_tick(main_scan_time);
+    kbfun_tap_dance_tick(main_scan_time);
+    kbfun_leader_tick(main_scan_time);
+    main_oneshot_tick(main_scan_time);
+    kbfun_dynamic_macro_tick();
+    kbfun_macro_tick();
+
+    // changes are taken against what has been handled, not the last scan, so
+    // ones held back (and everything after them) are picked up next pass
+    bool blocked = false;
+    for (uint8_t row=0; row<KB_ROWS; row++) {
+        for (uint8_t col=0; col<KB_COLUMNS; col++) {
+            bool is_pressed = (*main_kb_is_pressed)[row][col];
+            bool was_pressed = main_kb_processed[row][col];
+
+            if (is_pressed != was_pressed && !blocked)
+                blocked = main_events_blocked();
+
+            if (is_pressed != was_pressed && !blocked) {
+                main_kb_processed[row][col] = is_pressed;
+                key_event_t event = {
+                    .row     = row,
+                    .col     = col,
+                    .pressed = is_pressed,
+                    .time    = main_scan_time,
+                };
+                main_tap_hold_event(&event);
+                telemetry_key_event( row * KB_COLUMNS + col, is_pressed,
+                                     main_scan_time );
+            }
+        }
+    }
+
+    // send the USB reports (they're only queued if something changed)
+    sched_trigger(&main_tasks[MAIN_TASK_KEYBOARD_REPORT]);
+    sched_trigger(&main_tasks[MAIN_TASK_EXTRA_REPORT]);
+}
+
+static void main_task_keyboard_report(void) {
+    if (usb_keyboard_send() == 0)
+        mods_report_sent();
+}
+
+static void main_task_extra_report(void) {
+    usb_extra_consumer_send();
+    usb_extra_system_send();
+}
+
+/*
+ * An auto-shift key has been held for `AUTO_SHIFT_TERM`
+ */
+static void main_task_auto_shift(void) {
+    if (!main_as.pending)
+        return;
+
+    main_auto_shift_decide(true);
+    sched_trigger(&main_tasks[MAIN_TASK_KEYBOARD_REPORT]);
+}
+
+static void main_auto_shift_arm(uint16_t time) {
+    sched_trigger_at(&main_tasks[MAIN_TASK_AUTO_SHIFT], time);
+}
+static void main_auto_shift_disarm(void) {
+    sched_cancel(&main_tasks[MAIN_TASK_AUTO_SHIFT]);
+}
+
+/*
+ * A dual role key has been held for `TAP_HOLD_TERM`
+ */
+static void main_task_tap_hold(void) {
+    if (!main_th.pending)
+        return;
+
+    main_tap_hold_decide(true);
+    sched_trigger(&main_tasks[MAIN_TASK_KEYBOARD_REPORT]);
+    sched_trigger(&main_tasks[MAIN_TASK_EXTRA_REPORT]);
+}
+
+static void main_tap_hold_arm(uint16_t time) {
+    sched_trigger_at(&main_tasks[MAIN_TASK_TAP_HOLD], time);
+}
+static void main_tap_hold_disarm(void) {
+    sched_cancel(&main_tasks[MAIN_TASK_TAP_HOLD]);
+}
+
+static void main_task_leds(void) {
+    if (keyboard_leds & (1<<0)) { kb_led_num_on(); }
+    else { kb_led_num_off(); }
+    if (keyboard_leds & (1<<1)) { kb_led_caps_on(); }
+    else { kb_led_caps_off(); }
+    if (keyboard_leds & (1<<2)) { kb_led_scroll_on(); }
+    else { kb_led_scroll_off(); }
+    if (keyboard_leds & (1<<3)) { kb_led_compose_on(); }
+    else { kb_led_compose_off(); }
+    if (keyboard_leds & (1<<4)) { kb_led_kana_on(); }
+    else { kb_led_kana_off(); }
+}
+
+/*
+ * Carry out a command from the host, received over raw HID, and send the
+ * reply (see "lib/keymap.h")
+ *
+ * Note
+ * - Never waits.  While a reply can't be sent, it's kept, and no more
+ *   commands are read (the host's wait in the endpoint, unacknowledged).
+ */
+static void main_task_rawhid(void) {
+    static uint8_t packet[RAWHID_RX_SIZE];
+    static bool    replying;
+
+    if (!replying) {
+        if (usb_rawhid_recv(packet) <= 0)
+            return;
+        replying = keymap_command(packet);
+    }
+    if (replying && usb_rawhid_send(packet) > 0)
+        replying = false;
+}
 
 // ----------------------------------------------------------------------------
-// uint8_t usb_rawhid_fill = 0;
-// uint8_t usb_rawhid_buffer[64];
 
 /*
  * main()
  */
 int main(void) {
+	debug_init();  // before anything that might print
 	kb_init();  // does controller initialization too
     //teensy_init(); // return 1
     //mcp23018_init(); // return 2
+	timer_init();
 
 	kb_led_state_power_on();
 
@@ -137,189 +1306,20 @@ int main(void) {
 
 	kb_led_state_ready();
 
-    uint8_t key_row=0, key_col=0;
+	keymap_init(&custom_layout[0][0][0], KB_LAYERS, KB_ROWS, KB_COLUMNS);
 
     main_l_mode = 0;
     main_r_mode = 0;
-    main_key_modifiers = 0;
-    main_direct_modifiers = 0;
-
-	for (;;) {
-		// swap `main_kb_is_pressed` and `main_kb_was_pressed`, then update
-		bool (*temp)[KB_ROWS][KB_COLUMNS] = main_kb_was_pressed;
-		main_kb_was_pressed = main_kb_is_pressed;
-		main_kb_is_pressed = temp;
-
-		kb_update_matrix(*main_kb_is_pressed);
-
-		// this loop is responsible to
-		// - "execute" keys when they change state
-		// - keep track of which layers the keys were on when they were pressed
-		//   (so they can be released using the function from that layer)
-		//
-		// note
-		// - everything else is the key function's responsibility
-		//   - see the keyboard layout file ("keyboard/ergodox/layout/*.c") for
-		//     which key is assigned which function (per layer)
-		//   - see "lib/key-functions/public/*.c" for the function definitions
-		#define row          main_loop_row
-		#define col          main_loop_col
-		#define layer        main_arg_layer
-		#define is_pressed   main_arg_is_pressed
-		#define was_pressed  main_arg_was_pressed
-        //if ((*main_kb_is_pressed)[5][0] > (*main_kb_was_pressed)[5][0]) {
-        //    main_l_mode = 0;
-        //    main_r_mode = 0;
-        //}
-        //else {
-		//	for (col=0; col<5; col++) {
-        //        if ((*main_kb_is_pressed)[5][1+col] > (*main_kb_was_pressed)[5][1+col]) {
-        //            main_l_mode = col;
-        //        }
-        //        if ((*main_kb_is_pressed)[5][8+col] > (*main_kb_was_pressed)[5][8+col]) {
-        //            main_r_mode = col;
-        //        }
-        //    }
-        //}
-        uint8_t mode = main_l_mode;
-
-        #define GOING_DOWN(row, col) ((*main_kb_is_pressed)[row][col] > (*main_kb_was_pressed)[row][col])
-        #define PRESSED(row, col) (*main_kb_is_pressed)[row][col]
-        if (GOING_DOWN(5, 7)) main_l_mode ^= 2;
-        if (PRESSED(2, 6)) mode = 1;
-        if (PRESSED(2, 7)) mode = 1;
-
-		for (row=0; row<KB_ROWS; row++) {
-			for (col=0; col<KB_COLUMNS; col++) {
-				is_pressed = (*main_kb_is_pressed)[row][col];
-				was_pressed = (*main_kb_was_pressed)[row][col];
-
-                //uint8_t mode = (col < KB_COLUMNS/2)?main_l_mode:main_r_mode;
-
-				if (is_pressed != was_pressed) {
-
-					if (is_pressed) {
-                        uint16_t kc = pgm_read_word(&custom_layout[mode][KB_ROWS - 1 - row][col]);
-                        uint8_t h = (kc >> 8);
-                        uint8_t c = (kc & 255);
-                        kb_history[row][col] = c;
-
-                        if ((c & 0xE8) == 0xE0) {
-                            main_direct_modifiers |= (1 << (c & 7));
-                        } else {
-                            key_row = row;
-                            key_col = col;
-                            main_key_modifiers = h;
-                            // If they key was already pressed, "repeat" the keypress.
-                            for (uint8_t i = 0; i < 6; i++) {
-                                if (keyboard_keys[i] == c) {
-                                    keyboard_keys[i] = 0;
-                                    usb_keyboard_send();
-                                    break;
-                                }
-                            }
-                            for (uint8_t i = 0; i < 6; i++) {
-                                if (keyboard_keys[i] == 0) {
-                                    keyboard_keys[i] = c;
-                                    break;
-                                }
-                            // Otherwise here, the buffer send would have to maintain the modified semantics.
-                            // TODO: Consider how to handle the simultaneous modifier presses.
-                            }
-                        }
-                    } else {
-                        uint16_t c = kb_history[row][col];
-
-                        if ((c & 0xE8) == 0xE0) {
-                            main_direct_modifiers &= ~(1 << (c & 7));
-                        } else {
-                            // The last pressed modifier is preserved
-                            // If all keys are released, the modifier is released.
-                            for (uint8_t i = 0; i < 6; i++) {
-                                if (keyboard_keys[i] == c) {
-                                    keyboard_keys[i] = 0;
-                                    break;
-                                }
-                            }
-                            if (key_row == row && key_col == col) {
-                                main_key_modifiers = 0;
-                            }
-                        }
-                    }
-                    // Modifier key press causes modifier inversion.
-                    keyboard_modifier_keys = main_direct_modifiers ^ main_key_modifiers;
-
-//                  if (is_pressed) {
-//						layer = main_layers_peek(0);
-//						main_layers_pressed[row][col] = layer;
-//						main_arg_trans_key_pressed = false;
-//					} else {
-//						layer = main_layers_pressed[row][col];
-//						main_arg_trans_key_pressed = main_kb_was_transparent[row][col];
-//					}
-
-					// set remaining vars, and "execute" key
-					// main_arg_row          = row;
-					// main_arg_col          = col;
-					// main_arg_layer_offset = 0;
-					// main_exec_key();
-					// main_kb_was_transparent[row][col] = main_arg_trans_key_pressed;
-
-                    // usb_rawhid_buffer[usb_rawhid_fill++] = is_pressed ? 1 : 2;
-                    // usb_rawhid_buffer[usb_rawhid_fill++] = col*KB_COLUMNS + row;
-                    // if (usb_rawhid_fill >= 64) {
-                    //     usb_rawhid_send(usb_rawhid_buffer, 0);
-                    //     usb_rawhid_fill = 0;
-                    // }
-				}
-			}
-		}
-		#undef row
-		#undef col
-		#undef layer
-		#undef is_pressed
-		#undef was_pressed
-
-		// send the USB report (even if nothing's changed)
-		usb_keyboard_send();
-		usb_extra_consumer_send();
-       
-        // This addition sends rawhid packet if it is filled up.
-        // if (usb_rawhid_fill > 0) {
-        //     while (usb_rawhid_fill < 64) usb_rawhid_buffer[usb_rawhid_fill++] = 0;
-        //     usb_rawhid_send(usb_rawhid_buffer, 0);
-        //     usb_rawhid_fill = 0;
-        // }
-
-		_delay_ms(MAKEFILE_DEBOUNCE_TIME);
-
-		// update LEDs
-		if (keyboard_leds & (1<<0)) { kb_led_num_on(); }
-		else { kb_led_num_off(); }
-		if (keyboard_leds & (1<<1)) { kb_led_caps_on(); }
-		else { kb_led_caps_off(); }
-		if (keyboard_leds & (1<<2)) { kb_led_scroll_on(); }
-		else { kb_led_scroll_off(); }
-		if (keyboard_leds & (1<<3)) { kb_led_compose_on(); }
-		else { kb_led_compose_off(); }
-		if (keyboard_leds & (1<<4)) { kb_led_kana_on(); }
-		else { kb_led_kana_off(); }
-	}
+
+	sched_init(main_tasks, MAIN_TASKS);
+	for (;;)
+		sched_run(main_tasks, MAIN_TASKS);
 
 	return 0;
 }
 
 // ----------------------------------------------------------------------------
 
-// convenience macros (for the helper functions below)
-// #define  layer        main_arg_layer
-// #define  row          main_arg_row
-// #define  col          main_arg_col
-// #define  is_pressed   main_arg_is_pressed
-// #define  was_pressed  main_arg_was_pressed
-
-// ----------------------------------------------------------------------------
-
 /* ----------------------------------------------------------------------------
  * Layer Functions
  * ----------------------------------------------------------------------------
@@ -332,115 +1332,126 @@ int main(void) {
 
 // ----------------------------------------------------------------------------
 
-// struct layers {
-// 	uint8_t layer;
-// 	uint8_t id;
-// 	uint8_t sticky;
-// };
-// 
-// // ----------------------------------------------------------------------------
-// 
-// struct layers layers[MAX_ACTIVE_LAYERS];
-// uint8_t       layers_head = 0;
-// uint8_t       layers_ids_in_use[MAX_ACTIVE_LAYERS] = {true};
-// 
-// /*
-//  * Exec key
-//  * - Execute the keypress or keyrelease function (if it exists) of the key at
-//  *   the current possition.
-//  */
-// void main_exec_key(void) {
-// 	void (*key_function)(void) =
-// 		( (is_pressed)
-// 		  ? kb_layout_press_get(layer, row, col)
-// 		  : kb_layout_release_get(layer, row, col) );
-// 
-// 	if (key_function)
-// 		(*key_function)();
-// 
-// 	// If the current layer is in the sticky once up state and a key defined
-// 	//  for this layer (a non-transparent key) was pressed, pop the layer
-// 	if (layers[layers_head].sticky == eStickyOnceUp && main_arg_any_non_trans_key_pressed)
-// 		main_layers_pop_id(layers_head);
-// }
-// 
-// /*
-//  * peek()
-//  *
-//  * Arguments
-//  * - 'offset': the offset (down the stack) from the head element
-//  *
-//  * Returns
-//  * - success: the layer-number of the requested element (which may be 0)
-//  * - failure: 0 (default) (out of bounds)
-//  */
-// uint8_t main_layers_peek(uint8_t offset) {
-// 	if (offset <= layers_head)
-// 		return layers[layers_head - offset].layer;
-// 
-// 	return 0;  // default, or error
-// }
-// 
-// uint8_t main_layers_peek_sticky(uint8_t offset) {
-// 	if (offset <= layers_head)
-// 		return layers[layers_head - offset].sticky;
-// 
-// 	return 0;  // default, or error
-// }
-// 
-// /*
-//  * push()
-//  *
-//  * Arguments
-//  * - 'layer': the layer-number to push to the top of the stack
-//  *
-//  * Returns
-//  * - success: the id assigned to the newly added element
-//  * - failure: 0 (the stack was already full)
-//  */
-// uint8_t main_layers_push(uint8_t layer, uint8_t sticky) {
-// 	// look for an available id
-// 	for (uint8_t id=1; id<MAX_ACTIVE_LAYERS; id++) {
-// 		// if one is found
-// 		if (layers_ids_in_use[id] == false) {
-// 			layers_ids_in_use[id] = true;
-// 			layers_head++;
-// 			layers[layers_head].layer = layer;
-// 			layers[layers_head].id = id;
-// 			layers[layers_head].sticky = sticky;
-// 			return id;
-// 		}
-// 	}
-// 
-// 	return 0;  // default, or error
-// }
-// 
-// /*
-//  * pop_id()
-//  *
-//  * Arguments
-//  * - 'id': the id of the element to pop from the stack
-//  */
-// void main_layers_pop_id(uint8_t id) {
-// 	// look for the element with the id we want to pop
-// 	for (uint8_t element=1; element<=layers_head; element++) {
-// 		// if we find it
-// 		if (layers[element].id == id) {
-// 			for(; element<layers_head; ++element) {
-// 				layers[element].layer = layers[element+1].layer;
-// 				layers[element].id = layers[element+1].id;
-// 			}
-// 			// reinitialize the topmost (now unused) slot
-// 			layers[layers_head].layer = 0;
-// 			layers[layers_head].id = 0;
-// 			// record keeping
-// 			layers_ids_in_use[id] = false;
-// 			layers_head--;
-// 			return;
-// 		}
-// 	}
-// }
-// 
-// /* ----------------------------------------------------------------------------
-//  * ------------------------------------------------------------------------- */
-// 
+struct layers {
+	uint8_t layer;
+	uint8_t id;
+	uint8_t sticky;
+};
+
+// ----------------------------------------------------------------------------
+
+struct layers layers[MAX_ACTIVE_LAYERS];
+uint8_t       layers_head = 0;
+uint8_t       layers_ids_in_use[MAX_ACTIVE_LAYERS] = {true};
+
+/*
+ * Exec key
+ * - Execute the keypress or keyrelease function (if it exists) of the key at
+ *   the event's position, on the event's layer.
+ *
+ * Note
+ * - Called for keys that are `KF` in `custom_layout` (so a layout can use the
+ *   functions in "lib/key-functions" and the keyboard layout's press and
+ *   release matrices for them), and again by `kbfun_transparent()`
+ */
+void main_exec_key(key_event_t * event) {
+	kbfun_funptr_t key_function =
+		( (event->pressed)
+		  ? kb_layout_press_get(event->layer, event->row, event->col)
+		  : kb_layout_release_get(event->layer, event->row, event->col) );
+
+	if (key_function) {
+		// keep `main_arg` valid for `KBFUN_COMPAT()` wrappers, including
+		// across the nested call made by `kbfun_transparent()`
+		key_event_t * caller = main_arg;
+		main_arg = event;
+		(*key_function)(event);
+		main_arg = caller;
+	}
+
+	// If the current layer is in the sticky once up state and a key defined
+	//  for this layer (a non-transparent key) was pressed, pop the layer
+	if (layers[layers_head].sticky == eStickyOnceUp && main_any_non_trans_key_pressed)
+		main_layers_pop_id(layers_head);
+}
+
+/*
+ * peek()
+ *
+ * Arguments
+ * - 'offset': the offset (down the stack) from the head element
+ *
+ * Returns
+ * - success: the layer-number of the requested element (which may be 0)
+ * - failure: 0 (default) (out of bounds)
+ */
+uint8_t main_layers_peek(uint8_t offset) {
+	if (offset <= layers_head)
+		return layers[layers_head - offset].layer;
+
+	return 0;  // default, or error
+}
+
+uint8_t main_layers_peek_sticky(uint8_t offset) {
+	if (offset <= layers_head)
+		return layers[layers_head - offset].sticky;
+
+	return 0;  // default, or error
+}
+
+/*
+ * push()
+ *
+ * Arguments
+ * - 'layer': the layer-number to push to the top of the stack
+ *
+ * Returns
+ * - success: the id assigned to the newly added element
+ * - failure: 0 (the stack was already full)
+ */
+uint8_t main_layers_push(uint8_t layer, uint8_t sticky) {
+	// look for an available id
+	for (uint8_t id=1; id<MAX_ACTIVE_LAYERS; id++) {
+		// if one is found
+		if (layers_ids_in_use[id] == false) {
+			layers_ids_in_use[id] = true;
+			layers_head++;
+			layers[layers_head].layer = layer;
+			layers[layers_head].id = id;
+			layers[layers_head].sticky = sticky;
+			return id;
+		}
+	}
+
+	return 0;  // default, or error
+}
+
+/*
+ * pop_id()
+ *
+ * Arguments
+ * - 'id': the id of the element to pop from the stack
+ */
+void main_layers_pop_id(uint8_t id) {
+	// look for the element with the id we want to pop
+	for (uint8_t element=1; element<=layers_head; element++) {
+		// if we find it
+		if (layers[element].id == id) {
+			for(; element<layers_head; ++element) {
+				layers[element].layer = layers[element+1].layer;
+				layers[element].id = layers[element+1].id;
+			}
+			// reinitialize the topmost (now unused) slot
+			layers[layers_head].layer = 0;
+			layers[layers_head].id = 0;
+			// record keeping
+			layers_ids_in_use[id] = false;
+			layers_head--;
+			return;
+		}
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ * ------------------------------------------------------------------------- */
+
@@ -12,6 +12,7 @@
 
 	#include <stdbool.h>
 	#include <stdint.h>
+	#include "./lib/data-types/misc.h"
 	#include "./keyboard/matrix.h"
 
 	// --------------------------------------------------------------------
@@ -29,21 +30,40 @@
 
 	extern uint8_t main_layers_pressed[KB_ROWS][KB_COLUMNS];
 
-	extern uint8_t main_loop_row;
-	extern uint8_t main_loop_col;
+	extern bool main_any_non_trans_key_pressed;
 
-	extern uint8_t main_arg_layer;
-	extern uint8_t main_arg_layer_offset;
-	extern uint8_t main_arg_row;
-	extern uint8_t main_arg_col;
-	extern bool    main_arg_is_pressed;
-	extern bool    main_arg_was_pressed;
-	extern bool    main_arg_any_non_trans_key_pressed;
-	extern bool    main_arg_trans_key_pressed;
+	// --------------------------------------------------------------------
+
+	/*
+	 * compatibility with `void (*)(void)` key functions
+	 *
+	 * Key functions used to get their arguments from `main_arg_*`
+	 * globals.  `KBFUN_COMPAT(name, function)` defines `name`, a key
+	 * function that calls the old style `function`, which can then read
+	 * the event being executed through the old names; `name` is what goes
+	 * in a layout's press and release matrices.
+	 */
+	extern key_event_t * main_arg;
+
+	#define  main_arg_layer              (main_arg->layer)
+	#define  main_arg_layer_offset       (main_arg->layer_offset)
+	#define  main_arg_row                (main_arg->row)
+	#define  main_arg_col                (main_arg->col)
+	#define  main_arg_is_pressed         (main_arg->pressed)
+	#define  main_arg_trans_key_pressed  (main_arg->trans)
+
+	#define  KBFUN_COMPAT(name, function)                 \
+		void name(key_event_t * event) {              \
+			(void)event;  /* read as `main_arg` */ \
+			function();                           \
+		}
 
 	// --------------------------------------------------------------------
 
-	void main_exec_key (void);
+	void main_exec_key (key_event_t * event);
+
+	void main_action_press   (uint16_t action);
+	void main_action_release (uint16_t action);
 
 	uint8_t main_layers_peek          (uint8_t offset);
 	uint8_t main_layers_peek_sticky   (uint8_t offset);
@@ -0,0 +1,112 @@
+/* ----------------------------------------------------------------------------
+ * combo benchmark
+ *
+ * Times `main_combo_event()` with the combos in "combo-bench.h", for three
+ * kinds of key event: a key in no combo, a combo that fires, and a key that
+ * might have started a combo but didn't (so it's let through late).
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define main firmware_main
+#include "main-combo-bench.c"
+#undef main
+
+// ----------------------------------------------------------------------------
+
+#define ROUNDS  200000
+
+static void event(uint8_t position, bool pressed) {
+	key_event_t e = {
+		.row     = position / KB_COLUMNS,
+		.col     = position % KB_COLUMNS,
+		.pressed = pressed,
+	};
+	main_combo_event(&e);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void check(bool ok, const char * what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		exit(1);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void plain(void) {
+	event(COMBO_BENCH_OTHER, true);
+	event(COMBO_BENCH_OTHER, false);
+}
+
+static void fired(void) {
+	event(COMBO_BENCH_SHARED, true);
+	event(COMBO_BENCH_KEY(COMBO_COUNT-1), true);
+	event(COMBO_BENCH_KEY(COMBO_COUNT-1), false);
+	event(COMBO_BENCH_SHARED, false);
+}
+
+static void no_match(void) {
+	event(COMBO_BENCH_SHARED, true);
+	event(COMBO_BENCH_OTHER, true);
+	event(COMBO_BENCH_OTHER, false);
+	event(COMBO_BENCH_SHARED, false);
+}
+
+/*
+ * Time per event, in ns, of `run` (which sends `events` events): the best of
+ * a few tries, to leave out what else the host was doing
+ */
+static double measure(void (*run)(void), uint8_t events) {
+	uint64_t best = UINT64_MAX;
+	for (uint8_t try=0; try<5; try++) {
+		uint64_t start = now_ns();
+		for (uint32_t i=0; i<ROUNDS; i++)
+			(*run)();
+		uint64_t time = now_ns() - start;
+		if (time < best)
+			best = time;
+	}
+	return (double)best / ((double)ROUNDS * events);
+}
+
+int main(void) {
+	keymap_init(&custom_layout[0][0][0], KB_LAYERS, KB_ROWS, KB_COLUMNS);
+
+	// make sure each kind of event does what it's supposed to
+	event(COMBO_BENCH_SHARED, true);
+	check(main_combo_buffered == 1, "the shared key waits");
+	event(COMBO_BENCH_KEY(COMBO_COUNT-1), true);
+	check( main_combo_fired[0].active && keyboard_key_is_set(0x04),
+	       "the last combo fires" );
+	event(COMBO_BENCH_KEY(COMBO_COUNT-1), false);
+	event(COMBO_BENCH_SHARED, false);
+	check(!keyboard_key_is_set(0x04), "the combo is released");
+
+	event(COMBO_BENCH_SHARED, true);
+	event(COMBO_BENCH_OTHER, true);
+	check( keyboard_key_is_set(0x14) && keyboard_key_is_set(0x1A),
+	       "both keys go through when there's no match" );
+	event(COMBO_BENCH_OTHER, false);
+	event(COMBO_BENCH_SHARED, false);
+
+	printf( "%2u combos:  plain %6.1f ns/event,  fired %6.1f ns/event,  "
+	        "no match %6.1f ns/event  (host time)\n",
+	        (unsigned)COMBO_COUNT,
+	        measure(&plain, 2), measure(&fired, 4), measure(&no_match, 4) );
+	return 0;
+}
+
@@ -0,0 +1,40 @@
+/* ----------------------------------------------------------------------------
+ * combo benchmark : the combo table
+ *
+ * Put in place of the one in "main.c" (see "makefile").  `COMBO_BENCH_SIZE`
+ * combos, of two keys each, all sharing their first key: the worst case,
+ * since pressing that key makes every combo a candidate.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+// keys with plain keycodes on layer 0 (see `custom_layout`): one shared by
+// every combo, and one in none
+#define COMBO_BENCH_SHARED  COMBO_POSITION(4, 1)
+#define COMBO_BENCH_OTHER   COMBO_POSITION(4, 2)
+
+// the second key of combo `i`: any position but those two
+#define COMBO_BENCH_KEY(i)  \
+	( (i) < COMBO_BENCH_SHARED ? (i) : (i) + 2 )
+
+#define _BENCH_1(i)  COMBO2( 0x0004,  /* a */                               \
+                             COMBO_BENCH_SHARED, COMBO_BENCH_KEY(i) ),
+#define _BENCH_8(i)  _BENCH_1(i+0) _BENCH_1(i+1) _BENCH_1(i+2) _BENCH_1(i+3) \
+                     _BENCH_1(i+4) _BENCH_1(i+5) _BENCH_1(i+6) _BENCH_1(i+7)
+
+const combo_t PROGMEM combos[] = {
+#if COMBO_BENCH_SIZE == 1
+	_BENCH_1(0)
+#elif COMBO_BENCH_SIZE == 8
+	_BENCH_8(0)
+#elif COMBO_BENCH_SIZE == 64
+	_BENCH_8(0)  _BENCH_8(8)  _BENCH_8(16) _BENCH_8(24)
+	_BENCH_8(32) _BENCH_8(40) _BENCH_8(48) _BENCH_8(56)
+#else
+	#error "COMBO_BENCH_SIZE must be 1, 8, or 64"
+#endif
+};
+
@@ -0,0 +1,100 @@
+/* ----------------------------------------------------------------------------
+ * dynamic macro playback benchmark
+ *
+ * Records a macro of `TAPS` key taps, and plays it back to the emulated host
+ * ("usb-host.c"): `kbfun_dynamic_macro_tick()` runs once per scan (every
+ * `DEBOUNCE_TIME` ms, as in "main.c"), and the USB driver and host run every
+ * frame.  Throughput is the reports the host took, per second, from the
+ * start of playback to the last one.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#define USB_SERIAL_PRIVATE_INCLUDE
+#include "../usb_keyboard_rawhid.h"
+#include "./usb-host.h"
+
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+// ----------------------------------------------------------------------------
+
+#define TAPS        60  // as many as fit in the arena (2 bytes each)
+#define FIRST_KEY   4   // 'a', then the keys after it
+#define SCAN_EVERY  MAKEFILE_DEBOUNCE_TIME
+#define KEYBOARD_ENDPOINT  1  // as in "usb_keyboard_rawhid.c"
+
+// ----------------------------------------------------------------------------
+
+static void check(bool ok, const char * what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		exit(1);
+	}
+}
+
+/*
+ * Whether `packet` is the report for step `step` of playback: a key pressed
+ * (on even steps), or nothing (on odd ones)
+ */
+static bool expected(const uint8_t * packet, uint16_t step) {
+	uint8_t keys[KEYBOARD_KEYS_BYTES] = {0};
+	if (step % 2 == 0) {
+		uint8_t key = FIRST_KEY + step/2;
+		keys[key >> 3] |= (1 << (key & 7));
+	}
+	return packet[0] == 0 && !memcmp(packet+1, keys, sizeof(keys));
+}
+
+// ----------------------------------------------------------------------------
+
+int main(void) {
+	uint8_t packet[64];
+
+	check(usb_host_enumerate(), "enumeration");
+	uint8_t interval = usb_host_interval[KEYBOARD_ENDPOINT];
+	check( !usb_host_control(0x21, HID_SET_IDLE, 0, 0, 0, NULL),
+	       "SET_IDLE" );
+
+	kbfun_dynamic_macro_record();
+	for (uint8_t i=0; i<TAPS; i++) {
+		kbfun_dynamic_macro_event(FIRST_KEY + i, true);
+		kbfun_dynamic_macro_event(FIRST_KEY + i, false);
+	}
+	kbfun_dynamic_macro_record();
+
+	kbfun_dynamic_macro_play();
+	uint16_t taken = 0;
+	uint32_t ms    = 0;
+	uint16_t dry   = 0;  // frames the endpoint had nothing, mid playback
+	while (taken < 2*TAPS) {
+		check(ms < 10000, "playback finished");
+		if (ms % SCAN_EVERY == 0)
+			kbfun_dynamic_macro_tick();
+		usb_host_frame();
+		ms++;
+		if (usb_host_frames % interval)
+			continue;
+		if (usb_host_in(KEYBOARD_ENDPOINT, packet) < 0) {
+			dry++;
+			continue;
+		}
+		check(expected(packet, taken), "the macro, in order");
+		taken++;
+	}
+
+	check(!stub_endpoint_errors, "no endpoint errors");
+	check(!keyboard_reports_dropped, "no reports dropped");
+
+	printf( "%u reports in %u ms (bInterval %u ms, a scan every %u ms):  "
+	        "%u reports/s; the host found none %u times\n",
+	        taken, ms, interval, SCAN_EVERY, taken * 1000 / ms, dry );
+	return 0;
+}
+
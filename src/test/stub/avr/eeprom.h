@@ -0,0 +1,32 @@
+/* ----------------------------------------------------------------------------
+ * host stand-in for <avr/eeprom.h>
+ *
+ * `EEMEM` variables are placed in their own section, which "registers.c"
+ * maps onto an emulated EEPROM (erased, all 0xFF, at the start).
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef TEST__STUB__AVR__EEPROM_h
+	#define TEST__STUB__AVR__EEPROM_h
+
+	#include <stddef.h>
+	#include <stdint.h>
+
+	// --------------------------------------------------------------------
+
+	#define EEMEM  __attribute__((section("eeprom")))
+
+	uint8_t  eeprom_read_byte   (const uint8_t * address);
+	uint16_t eeprom_read_word   (const uint16_t * address);
+	void     eeprom_read_block  (void * dst, const void * src, size_t n);
+	void     eeprom_write_byte  (uint8_t * address, uint8_t value);
+	void     eeprom_update_byte (uint8_t * address, uint8_t value);
+	void     eeprom_update_word (uint16_t * address, uint16_t value);
+	int      eeprom_is_ready    (void);
+
+#endif
+
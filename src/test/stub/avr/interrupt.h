@@ -0,0 +1,26 @@
+/* ----------------------------------------------------------------------------
+ * host stand-in for <avr/interrupt.h>
+ *
+ * An interrupt handler is an ordinary function, which a test calls to
+ * deliver the interrupt.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef TEST__STUB__AVR__INTERRUPT_h
+	#define TEST__STUB__AVR__INTERRUPT_h
+
+	#include <avr/io.h>
+
+	// --------------------------------------------------------------------
+
+	#define ISR(vector)  void vector(void); void vector(void)
+
+	#define cli()  ((void)0)
+	#define sei()  ((void)0)
+
+#endif
+
@@ -0,0 +1,135 @@
+/* ----------------------------------------------------------------------------
+ * host stand-in for <avr/io.h> : the ATmega32U4 registers the firmware uses
+ *
+ * Registers are plain variables (defined in "registers.c"), and bits have
+ * their real positions, so code that writes whole register values (as the
+ * USB driver does) means the same thing here.
+ *
+ * The USB endpoint registers are per endpoint (chosen by `UENUM`), and
+ * `UEINTX` and `UEDATX` act like the hardware's: see "registers.c".
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef TEST__STUB__AVR__IO_h
+	#define TEST__STUB__AVR__IO_h
+
+	#include <stdbool.h>
+	#include <stdint.h>
+
+	// --------------------------------------------------------------------
+
+	#define __AVR_ATmega32U4__  1
+
+	#define STUB_REGISTERS(X)                                              \
+		X(SREG)   X(CLKPR)  X(SPCR)   X(ACSR)   X(ADCSRA) X(EECR)      \
+		X(EIMSK)  X(PCICR)  X(UCSR1B)                                  \
+		X(DDRB)   X(DDRC)   X(DDRD)   X(DDRE)   X(DDRF)                \
+		X(PORTB)  X(PORTC)  X(PORTD)  X(PORTE)  X(PORTF)               \
+		X(PINB)   X(PINC)   X(PIND)   X(PINE)   X(PINF)                \
+		X(TCCR0A) X(TCCR0B) X(OCR0A)  X(TCNT0)  X(TIMSK0)              \
+		X(TCCR1A) X(TCCR1B) X(TIMSK1) X(TIMSK3) X(TIMSK4)              \
+		X(TWSR)   X(TWBR)   X(TWCR)   X(TWDR)                          \
+		X(UHWCON) X(USBCON) X(PLLCSR) X(UDCON)  X(UDIEN)  X(UDINT)     \
+		X(UDADDR) X(UDFNUML)                                           \
+		X(UENUM)  X(UERST)
+
+	#define STUB_DECLARE(name)  extern volatile uint8_t name;
+	STUB_REGISTERS(STUB_DECLARE)
+	#undef STUB_DECLARE
+
+	extern volatile uint16_t OCR1A, OCR1B, OCR1C;
+
+	// --------------------------------------------------------------------
+
+	#define STUB_ENDPOINTS  8  // as many as `UENUM` (3 bits) can choose
+
+	typedef struct {
+		uint8_t  data[2][64];
+		uint8_t  length[2];
+		uint8_t  full;      // how many banks are full (in order)
+		uint8_t  first;     // the first full one
+		uint8_t  position;  // the next byte (written, or read)
+	} stub_banks_t;
+
+	typedef struct {
+		volatile uint8_t ueconx, uecfg0x, uecfg1x, ueienx;
+		volatile uint8_t ueintx;  // as last read (or written)
+		uint8_t          shown;   // as last read
+		stub_banks_t     in;      // filled here, taken by the host
+		stub_banks_t     out;     // filled by the host, read here
+		bool             setup;   // `out` holds a SETUP packet
+	} stub_endpoint_t;
+
+	extern stub_endpoint_t stub_endpoints[STUB_ENDPOINTS];
+
+	// accesses to `UEINTX` and `UEDATX` (see "registers.c")
+	extern uint32_t stub_endpoint_accesses;
+	extern uint32_t stub_endpoint_access_limit;
+	extern uint32_t stub_endpoint_errors;
+
+	volatile uint8_t * stub_ueintx (void);
+	volatile uint8_t * stub_uedatx (void);
+	void               stub_endpoints_settle (void);
+	uint8_t            stub_endpoint_size    (uint8_t endpoint);
+	uint8_t            stub_endpoint_banks   (uint8_t endpoint);
+
+	#define UECONX   (stub_endpoints[UENUM % STUB_ENDPOINTS].ueconx)
+	#define UECFG0X  (stub_endpoints[UENUM % STUB_ENDPOINTS].uecfg0x)
+	#define UECFG1X  (stub_endpoints[UENUM % STUB_ENDPOINTS].uecfg1x)
+	#define UEIENX   (stub_endpoints[UENUM % STUB_ENDPOINTS].ueienx)
+	#define UEINTX   (*stub_ueintx())
+	#define UEDATX   (*stub_uedatx())
+
+	// --------------------------------------------------------------------
+
+	// TCCR0A, TCCR0B, TIMSK0
+	#define WGM01     1
+	#define CS00      0
+	#define CS01      1
+	#define OCIE0A    1
+	// TWCR, TWSR
+	#define TWINT     7
+	#define TWEA      6
+	#define TWSTA     5
+	#define TWSTO     4
+	#define TWEN      2
+	#define TWPS1     1
+	#define TWPS0     0
+	// USBCON, PLLCSR
+	#define USBE      7
+	#define FRZCLK    5
+	#define OTGPADE   4
+	#define PLLP0     2
+	#define PLLE      1
+	#define PLOCK     0
+	// UDIEN, UDINT
+	#define EORSTE    3
+	#define SOFE      2
+	#define EORSTI    3
+	#define SOFI      2
+	// UDADDR
+	#define ADDEN     7
+	// UECFG0X
+	#define EPDIR     0
+	// UECONX
+	#define STALLRQ   5
+	#define STALLRQC  4
+	#define RSTDT     3
+	#define EPEN      0
+	// UEIENX
+	#define RXSTPE    3
+	#define RXOUTE    2
+	#define TXINE     0
+	// UEINTX
+	#define FIFOCON   7
+	#define RWAL      5
+	#define RXSTPI    3
+	#define RXOUTI    2
+	#define TXINI     0
+
+#endif
+
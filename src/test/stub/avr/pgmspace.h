@@ -0,0 +1,31 @@
+/* ----------------------------------------------------------------------------
+ * host stand-in for <avr/pgmspace.h>
+ *
+ * Flash is ordinary memory here.  `pgm_read_word()` reads whatever type it
+ * is pointed at, so tables of pointers work with the host's pointer size.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef TEST__STUB__AVR__PGMSPACE_h
+	#define TEST__STUB__AVR__PGMSPACE_h
+
+	#include <stdint.h>
+	#include <string.h>
+
+	// --------------------------------------------------------------------
+
+	#define PROGMEM
+	#define PSTR(s)  (s)
+
+	#define pgm_read_byte(address)  (*(const uint8_t *)(address))
+	#define pgm_read_word(address)  (*(address))
+
+	#define memcpy_P  memcpy
+	#define strlen_P  strlen
+
+#endif
+
@@ -0,0 +1,8 @@
+/* ----------------------------------------------------------------------------
+ * host stand-in for <avr/wdt.h> (nothing in it is used)
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
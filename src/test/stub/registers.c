@@ -0,0 +1,230 @@
+/* ----------------------------------------------------------------------------
+ * host stand-ins : registers and EEPROM
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <avr/io.h>
+
+// ----------------------------------------------------------------------------
+
+#define STUB_DEFINE(name)  volatile uint8_t name;
+STUB_REGISTERS(STUB_DEFINE)
+#undef STUB_DEFINE
+
+volatile uint16_t OCR1A, OCR1B, OCR1C;
+
+// ----------------------------------------------------------------------------
+// USB endpoints
+//
+// Each endpoint has its own copy of the registers `UENUM` chooses between,
+// and banks the firmware and the host pass packets in.  `UEINTX` reads as
+// the state of the banks, and a write to it takes effect (for the bits it
+// clears) at the next access to `UEINTX` or `UEDATX`, or when the host
+// looks (`stub_endpoints_settle()`):
+// - IN endpoints: clearing FIFOCON sends the bank being filled.  RWAL is set
+//   while there's a free bank, and room in it.
+// - OUT endpoints: clearing FIFOCON frees the bank being read.  RWAL is set
+//   while there's a bank with bytes left in it.
+// - Endpoint 0: clearing RXSTPI or RXOUTI frees the SETUP or OUT packet, and
+//   clearing TXINI (except along with RXSTPI, which only acknowledges the
+//   SETUP) sends the IN bank.  `UEDATX` reads from a SETUP or OUT packet
+//   while there is one, and writes to the IN bank otherwise.
+// ----------------------------------------------------------------------------
+
+stub_endpoint_t stub_endpoints[STUB_ENDPOINTS];
+
+uint32_t stub_endpoint_accesses;
+// if not 0, the firmware is stopped (as waiting forever) when
+// `stub_endpoint_accesses` passes it
+uint32_t stub_endpoint_access_limit;
+// writes past the end of a bank (or with none free), and reads past the end
+// of a packet (or with none there)
+uint32_t stub_endpoint_errors;
+
+uint8_t stub_endpoint_size(uint8_t endpoint) {
+	return 8 << ((stub_endpoints[endpoint].uecfg1x >> 4) & 7);
+}
+uint8_t stub_endpoint_banks(uint8_t endpoint) {
+	return (stub_endpoints[endpoint].uecfg1x & (1<<2)) ? 2 : 1;
+}
+
+static bool is_control(uint8_t endpoint) {
+	return !(stub_endpoints[endpoint].uecfg0x & 0xC0);
+}
+static bool is_in(uint8_t endpoint) {
+	return stub_endpoints[endpoint].uecfg0x & (1<<EPDIR);
+}
+
+/*
+ * `UEINTX`, as the banks are now
+ */
+static uint8_t flags(uint8_t endpoint) {
+	stub_endpoint_t * ep    = &stub_endpoints[endpoint];
+	uint8_t           banks = stub_endpoint_banks(endpoint);
+	uint8_t           value = 0;
+
+	if (is_control(endpoint)) {
+		if (ep->out.full)
+			value |= ep->setup ? (1<<RXSTPI) : (1<<RXOUTI);
+		if (!ep->in.full)
+			value |= (1<<TXINI);
+	} else if (is_in(endpoint)) {
+		if (ep->in.full < banks) {
+			value |= (1<<FIFOCON) | (1<<TXINI);
+			if (ep->in.position < stub_endpoint_size(endpoint))
+				value |= (1<<RWAL);
+		}
+	} else if (ep->out.full) {
+		value |= (1<<FIFOCON) | (1<<RXOUTI);
+		if (ep->out.position < ep->out.length[ep->out.first])
+			value |= (1<<RWAL);
+	}
+	return value;
+}
+
+static void commit(stub_banks_t * b, uint8_t banks) {
+	b->length[(b->first + b->full) % banks] = b->position;
+	b->full++;
+	b->position = 0;
+}
+static void release(stub_banks_t * b, uint8_t banks) {
+	b->first = (b->first + 1) % banks;
+	b->full--;
+	b->position = 0;
+}
+
+/*
+ * Carry out what the firmware wrote to `UEINTX` (if it did), and show the
+ * endpoint as it is now
+ */
+static void settle(uint8_t endpoint) {
+	stub_endpoint_t * ep      = &stub_endpoints[endpoint];
+	uint8_t           banks   = stub_endpoint_banks(endpoint);
+	uint8_t           cleared = ep->shown & ~ep->ueintx;
+
+	if (is_control(endpoint)) {
+		if (cleared & (1<<RXSTPI)) {
+			release(&ep->out, 1);
+			ep->setup = false;
+		} else {
+			if (cleared & (1<<RXOUTI))
+				release(&ep->out, 1);
+			if (cleared & (1<<TXINI))
+				commit(&ep->in, 1);
+		}
+	} else if (cleared & (1<<FIFOCON)) {
+		if (is_in(endpoint))
+			commit(&ep->in, banks);
+		else
+			release(&ep->out, banks);
+	}
+
+	ep->ueintx = ep->shown = flags(endpoint);
+}
+
+void stub_endpoints_settle(void) {
+	for (uint8_t e=0; e<STUB_ENDPOINTS; e++)
+		settle(e);
+}
+
+static void access(void) {
+	stub_endpoints_settle();
+	stub_endpoint_accesses++;
+	if ( stub_endpoint_access_limit
+	     && stub_endpoint_accesses > stub_endpoint_access_limit ) {
+		fprintf(stderr, "endpoint %d: waiting forever\n", UENUM);
+		abort();
+	}
+}
+
+volatile uint8_t * stub_ueintx(void) {
+	access();
+	return &stub_endpoints[UENUM % STUB_ENDPOINTS].ueintx;
+}
+
+volatile uint8_t * stub_uedatx(void) {
+	static volatile uint8_t byte;  // read from, or written to, nowhere
+
+	access();
+	uint8_t           endpoint = UENUM % STUB_ENDPOINTS;
+	stub_endpoint_t * ep       = &stub_endpoints[endpoint];
+	uint8_t           banks    = stub_endpoint_banks(endpoint);
+	stub_banks_t *    b;
+
+	if (is_control(endpoint) ? ep->out.full : !is_in(endpoint)) {
+		b = &ep->out;
+		if (b->full && b->position < b->length[b->first]) {
+			byte = b->data[b->first][b->position++];
+			return &byte;
+		}
+	} else {
+		b = &ep->in;
+		if ( b->full < banks
+		     && b->position < stub_endpoint_size(endpoint) )
+			return &b->data[(b->first + b->full) % banks]
+			               [b->position++];
+	}
+	stub_endpoint_errors++;
+	byte = 0;
+	return &byte;
+}
+
+// ----------------------------------------------------------------------------
+
+#define EEPROM_SIZE  1024
+
+// the bounds of the "eeprom" section, from the linker
+extern uint8_t __start_eeprom[];
+extern uint8_t __stop_eeprom[];
+
+static uint8_t eeprom[EEPROM_SIZE];
+static bool    eeprom_erased;
+
+/*
+ * The emulated EEPROM byte for an `EEMEM` address
+ */
+static uint8_t * eeprom_byte(const void * address) {
+	if (!eeprom_erased) {
+		memset(eeprom, 0xFF, EEPROM_SIZE);
+		eeprom_erased = true;
+	}
+	return &eeprom[ ((const uint8_t *)address - __start_eeprom)
+	                % EEPROM_SIZE ];
+}
+
+uint8_t eeprom_read_byte(const uint8_t * address) {
+	return *eeprom_byte(address);
+}
+uint16_t eeprom_read_word(const uint16_t * address) {
+	const uint8_t * a = (const uint8_t *)address;
+	return *eeprom_byte(a) | (*eeprom_byte(a+1) << 8);
+}
+void eeprom_read_block(void * dst, const void * src, size_t n) {
+	for (size_t i=0; i<n; i++)
+		((uint8_t *)dst)[i] = *eeprom_byte((const uint8_t *)src + i);
+}
+void eeprom_write_byte(uint8_t * address, uint8_t value) {
+	*eeprom_byte(address) = value;
+}
+void eeprom_update_byte(uint8_t * address, uint8_t value) {
+	*eeprom_byte(address) = value;
+}
+void eeprom_update_word(uint16_t * address, uint16_t value) {
+	uint8_t * a = (uint8_t *)address;
+	*eeprom_byte(a)   = value & 0xFF;
+	*eeprom_byte(a+1) = value >> 8;
+}
+int eeprom_is_ready(void) {
+	return 1;
+}
+
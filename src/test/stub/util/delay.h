@@ -0,0 +1,17 @@
+/* ----------------------------------------------------------------------------
+ * host stand-in for <util/delay.h> : delays return at once
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef TEST__STUB__UTIL__DELAY_h
+	#define TEST__STUB__UTIL__DELAY_h
+
+	#define _delay_ms(ms)  ((void)(ms))
+	#define _delay_us(us)  ((void)(us))
+
+#endif
+
@@ -0,0 +1,205 @@
+/* ----------------------------------------------------------------------------
+ * keyboard report cadence and latency, through the USB driver
+ *
+ * Reports go in through `usb_keyboard_send()`, wait in the driver's queue,
+ * are moved to the endpoint by the start of frame interrupt, and are taken
+ * by the emulated host ("usb-host.c"), which polls the endpoint every
+ * `bInterval` frames (as read from the configuration descriptor).  Each
+ * frame, the start of frame interrupt runs first, then the host's poll (if
+ * it's due), then whatever key events fall in the rest of the frame.
+ *
+ * Latency is from the call to `usb_keyboard_send()` to the host's poll that
+ * takes the report.  It leaves out the scan, and debouncing, before it.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define USB_SERIAL_PRIVATE_INCLUDE
+#include "../usb_keyboard_rawhid.h"
+#include "./usb-host.h"
+
+// ----------------------------------------------------------------------------
+
+#define KEYBOARD_ENDPOINT  1  // as in "usb_keyboard_rawhid.c"
+#define KEY                4  // 'a'
+
+#define TAPS       1000   // keys tapped one at a time
+#define TAP_EVERY  100    // ms (at most) between the start of each
+#define TAP_HOLD   30     // ms each key is held
+#define BURSTS     200    // bursts of reports queued at once
+#define BURST_SIZE 6      // reports in each (as for typing "abc")
+#define SATURATE   10000  // ms of keeping the queue full
+
+// ----------------------------------------------------------------------------
+
+static uint8_t interval;
+
+// the reports queued and not yet taken by the host, oldest first
+static struct {
+	uint32_t time;  // when queued (in us)
+	uint8_t  modifier_keys;
+	uint8_t  keys[KEYBOARD_KEYS_BYTES];
+} sent[16];
+static uint8_t sent_head, sent_tail;
+
+// latency (in us) of the reports taken by the host
+static uint32_t taken;
+static uint64_t latency_sum;
+static uint32_t latency_max;
+
+static void check(bool ok, const char * what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		exit(1);
+	}
+}
+
+static uint32_t random_below(uint32_t n) {
+	static uint32_t seed = 1;
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % n;
+}
+
+/*
+ * Queue the report, as it is now, at `time` (in us)
+ */
+static void send(uint32_t time) {
+	uint8_t seq = keyboard_report_seq;
+
+	check(!usb_keyboard_send(), "report dropped");
+	if (keyboard_report_seq == seq)
+		return;  // the same as the last one
+
+	sent[sent_head].time          = time;
+	sent[sent_head].modifier_keys = keyboard_modifier_keys;
+	memcpy(sent[sent_head].keys, keyboard_keys, KEYBOARD_KEYS_BYTES);
+	sent_head = (sent_head + 1) % 16;
+	check(sent_head != sent_tail, "more reports waiting than expected");
+}
+
+static void toggle(uint32_t time) {
+	if (keyboard_key_is_set(KEY))
+		keyboard_key_clear(KEY);
+	else
+		keyboard_key_set(KEY);
+	send(time);
+}
+
+/*
+ * Run frame `frame`: the start of frame interrupt, and the host's poll
+ */
+static void frame(uint32_t frame) {
+	uint8_t packet[64];
+
+	usb_host_frame();
+	if (frame % interval)
+		return;
+	int8_t n = usb_host_in(KEYBOARD_ENDPOINT, packet);
+	if (n < 0)
+		return;
+
+	check(sent_tail != sent_head, "a report that wasn't sent");
+	check( n == 1 + KEYBOARD_KEYS_BYTES
+	       && packet[0] == sent[sent_tail].modifier_keys
+	       && !memcmp( packet+1, sent[sent_tail].keys,
+	                   KEYBOARD_KEYS_BYTES ),
+	       "a report out of order, or changed" );
+
+	uint32_t latency = frame * 1000 - sent[sent_tail].time;
+	sent_tail = (sent_tail + 1) % 16;
+	taken++;
+	latency_sum += latency;
+	if (latency > latency_max)
+		latency_max = latency;
+}
+
+static void measure_start(void) {
+	taken       = 0;
+	latency_sum = 0;
+	latency_max = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+int main(void) {
+	uint32_t f = 0;  // the frame
+
+	check(usb_host_enumerate(), "enumeration");
+	interval = usb_host_interval[KEYBOARD_ENDPOINT];
+	check( interval == MAKEFILE_USB_POLL_INTERVAL,
+	       "bInterval is USB_POLL_INTERVAL" );
+	// as most hosts do, so that only real changes are sent
+	check( !usb_host_control(0x21, HID_SET_IDLE, 0, 0, 0, NULL),
+	       "SET_IDLE" );
+
+	// keys tapped one at a time: a press and a release, at random times
+	measure_start();
+	for (uint16_t tap=0; tap<TAPS; tap++) {
+		uint32_t press   = f*1000 + random_below((TAP_EVERY-TAP_HOLD-20)
+		                                         * 1000);
+		uint32_t release = press + TAP_HOLD*1000;
+		for (uint32_t end=f+TAP_EVERY; f<end; f++) {
+			frame(f);
+			if (press/1000 == f) {
+				keyboard_key_set(KEY);
+				send(press);
+			}
+			if (release/1000 == f) {
+				keyboard_key_clear(KEY);
+				send(release);
+			}
+		}
+	}
+	check(taken == 2*TAPS, "every tap taken");
+	double   tap_mean = latency_sum / 1000.0 / taken;
+	uint32_t tap_max  = latency_max;
+	check(tap_max <= (interval + 1) * 1000, "tap latency within bInterval");
+
+	// bursts: `BURST_SIZE` reports queued at once (the latency of the last
+	// one is how long the burst took to get to the host)
+	uint64_t burst_sum = 0;
+	uint32_t burst_max = 0;
+	for (uint16_t burst=0; burst<BURSTS; burst++) {
+		uint32_t at = f*1000 + 1 + random_below(999);
+		frame(f++);
+		for (uint8_t i=0; i<BURST_SIZE; i++)
+			toggle(at);
+		measure_start();
+		while (taken < BURST_SIZE)
+			frame(f++);
+		burst_sum += latency_max;
+		if (latency_max > burst_max)
+			burst_max = latency_max;
+		f += 200;
+	}
+
+	// saturated: the queue kept full (from before the first frame)
+	measure_start();
+	for (uint32_t end=f+SATURATE; f<end; f++) {
+		while (usb_keyboard_queued() < KEYBOARD_QUEUE_SIZE - 1)
+			toggle(f*1000);
+		frame(f);
+	}
+	uint32_t rate = taken * 1000 / SATURATE;
+	check(rate == 1000 / interval, "one report per poll, saturated");
+
+	check(!stub_endpoint_errors, "no endpoint errors");
+	check(!keyboard_reports_dropped, "no reports dropped");
+
+	printf( "bInterval %2u ms:  tap latency %5.2f ms mean, %5.2f ms max;  "
+	        "%u report burst %5.1f ms mean, %5.1f ms max;  "
+	        "saturated %4u reports/s\n",
+	        interval, tap_mean, tap_max / 1000.0,
+	        BURST_SIZE, burst_sum / 1000.0 / BURSTS, burst_max / 1000.0,
+	        rate );
+	return 0;
+}
+
@@ -0,0 +1,177 @@
+/* ----------------------------------------------------------------------------
+ * endpoint 0 requests, and how long the interrupt for them runs
+ *
+ * Makes every control request the USB driver answers (and a few it
+ * shouldn't), through the emulated host ("usb-host.c"), and checks the
+ * replies.  Along the way, it counts the accesses to `UEINTX` and `UEDATX`
+ * each run of `ISR(USB_COM_vect)` makes: the time the handler takes goes
+ * with these (each data byte is one), and a handler that waits for the host
+ * would make them without end (the stub stops it, as a failure).
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define USB_SERIAL_PRIVATE_INCLUDE
+#include "../usb_keyboard_rawhid.h"
+#include "./usb-host.h"
+
+// ----------------------------------------------------------------------------
+
+// the most register accesses one run of the interrupt may make: reading a
+// SETUP packet (8 bytes), and writing a full reply packet (`ENDPOINT0_SIZE`
+// bytes), with a read and a write of the flags for each
+#define ACCESSES_BUDGET  (1 + 8 + 1 + 1 + 32 + 1)
+
+// as in "usb_keyboard_rawhid.c"
+#define KEYBOARD_INTERFACE  0
+#define EXTRA_INTERFACE     1
+#define RAWHID_INTERFACE    2
+#define KEYBOARD_ENDPOINT   1
+
+// ----------------------------------------------------------------------------
+
+static uint8_t d[256];
+
+static void check(bool ok, const char * what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		exit(1);
+	}
+}
+
+static int16_t get(uint8_t type, uint8_t request, uint16_t value,
+                   uint16_t index, uint16_t length) {
+	memset(d, 0xAA, sizeof(d));
+	return usb_host_control(type, request, value, index, length, d);
+}
+static int16_t set(uint8_t type, uint8_t request, uint16_t value,
+                   uint16_t index, uint16_t length) {
+	return usb_host_control(type, request, value, index, length, d);
+}
+
+static bool all(uint8_t value, uint16_t length) {
+	for (uint16_t i=0; i<length; i++)
+		if (d[i] != value)
+			return false;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+int main(void) {
+	uint16_t n;
+
+	check(usb_host_enumerate(), "enumeration");
+
+	// standard requests
+	check(get(0x80, GET_DESCRIPTOR, 0x0100, 0, 255) == 18, "device");
+	check(d[0] == 18 && d[1] == 1, "device descriptor");
+	check(get(0x80, GET_DESCRIPTOR, 0x0200, 0, 255) > 32, "configuration");
+	n = d[2] | (d[3] << 8);
+	check(get(0x80, GET_DESCRIPTOR, 0x0200, 0, 64) == 64, "cut short");
+	check(get(0x80, GET_DESCRIPTOR, 0x0300, 0, 255) == 4, "languages");
+	for (uint8_t i=1; i<=2; i++) {
+		check(get(0x80, GET_DESCRIPTOR, 0x0300+i, 0x0409, 255) > 2,
+		      "string");
+		check(d[1] == 3, "string descriptor");
+	}
+	check( get(0x80, GET_DESCRIPTOR, 0x0303, 0x0409, 255)
+	       == USB_HOST_STALL, "a string that isn't there stalls" );
+	check(get(0x80, GET_DESCRIPTOR, 0x0600, 0, 10) == USB_HOST_STALL,
+	      "an unknown descriptor stalls");
+	check(get(0x80, GET_CONFIGURATION, 0, 0, 1) == 1 && d[0] == 1,
+	      "GET_CONFIGURATION");
+	check(get(0x80, GET_STATUS, 0, 0, 2) == 2 && all(0, 2), "GET_STATUS");
+
+	// halting an endpoint
+	check(!set(0x02, SET_FEATURE, 0, 0x80|KEYBOARD_ENDPOINT, 0),
+	      "halt");
+	check( get(0x82, GET_STATUS, 0, 0x80|KEYBOARD_ENDPOINT, 2) == 2
+	       && d[0] == 1, "halted" );
+	check(!set(0x02, CLEAR_FEATURE, 0, 0x80|KEYBOARD_ENDPOINT, 0),
+	      "clear halt");
+	check( get(0x82, GET_STATUS, 0, 0x80|KEYBOARD_ENDPOINT, 2) == 2
+	       && d[0] == 0, "not halted" );
+
+	// HID descriptors, for each interface
+	for (uint8_t i=0; i<=RAWHID_INTERFACE; i++) {
+		check(get(0x81, GET_DESCRIPTOR, 0x2100, i, 255) == 9, "HID");
+		check(d[1] == 0x21, "HID descriptor");
+		uint16_t length = d[7] | (d[8] << 8);
+		check( get(0x81, GET_DESCRIPTOR, 0x2200, i, 255) == length,
+		       "report descriptor" );
+	}
+
+	// the keyboard interface
+	keyboard_modifier_keys = 0x02;
+	keyboard_key_set(4);
+	usb_keyboard_send();
+	usb_host_frame();
+	check(usb_host_in(KEYBOARD_ENDPOINT, NULL) > 0, "report sent");
+	check( get(0xA1, HID_GET_REPORT, 0x0100, KEYBOARD_INTERFACE, 255)
+	       == 1 + KEYBOARD_KEYS_BYTES && d[0] == 0x02 && d[1] == 0x10,
+	       "GET_REPORT" );
+	check( get(0xA1, HID_GET_IDLE, 0, KEYBOARD_INTERFACE, 1) == 1
+	       && d[0] == 125, "GET_IDLE" );
+	check(!set(0x21, HID_SET_IDLE, 0, KEYBOARD_INTERFACE, 0), "SET_IDLE");
+	check( get(0xA1, HID_GET_IDLE, 0, KEYBOARD_INTERFACE, 1) == 1
+	       && d[0] == 0, "idle set" );
+	check( get(0xA1, HID_GET_PROTOCOL, 0, KEYBOARD_INTERFACE, 1) == 1
+	       && d[0] == 1, "GET_PROTOCOL" );
+	check(!set(0x21, HID_SET_PROTOCOL, 0, KEYBOARD_INTERFACE, 0),
+	      "SET_PROTOCOL");
+	check( get(0xA1, HID_GET_REPORT, 0x0100, KEYBOARD_INTERFACE, 255) == 8
+	       && d[0] == 0x02 && d[2] == 4 && d[3] == 0,
+	       "GET_REPORT, boot protocol" );
+	check(!set(0x21, HID_SET_PROTOCOL, 1, KEYBOARD_INTERFACE, 0),
+	      "SET_PROTOCOL back");
+	d[0] = 0x02;
+	check(set(0x21, HID_SET_REPORT, 0x0200, KEYBOARD_INTERFACE, 1) == 1,
+	      "SET_REPORT");
+	check(keyboard_leds == 0x02, "LEDs set");
+
+	// the extra interface
+	check( get(0xA1, HID_GET_IDLE, 0, EXTRA_INTERFACE, 1) == 1
+	       && d[0] == 0, "GET_IDLE (extra)" );
+	check(!set(0x21, HID_SET_IDLE, 0, EXTRA_INTERFACE, 0),
+	      "SET_IDLE 0 (extra)");
+	check( set(0x21, HID_SET_IDLE, 0x0100, EXTRA_INTERFACE, 0)
+	       == USB_HOST_STALL, "other idle rates stall (extra)" );
+
+	// the raw HID interface
+	check( get(0xA1, HID_GET_REPORT, 0x0100, RAWHID_INTERFACE, 255)
+	       == RAWHID_TX_SIZE && all(0, RAWHID_TX_SIZE),
+	       "GET_REPORT (raw HID)" );
+	check( get(0xA1, HID_GET_REPORT, 0x0100, RAWHID_INTERFACE, 40) == 40
+	       && all(0, 40), "GET_REPORT (raw HID), cut short" );
+	memset(d, 0x55, RAWHID_RX_SIZE);
+	check( set(0x21, HID_SET_REPORT, 0x0200, RAWHID_INTERFACE,
+	           RAWHID_RX_SIZE) == RAWHID_RX_SIZE,
+	       "SET_REPORT (raw HID)" );
+	check(usb_rawhid_recv(d) == 0, "SET_REPORT data is ignored");
+
+	// something else, then something that works
+	check(get(0xA1, 0x7F, 0, KEYBOARD_INTERFACE, 8) == USB_HOST_STALL,
+	      "an unknown request stalls");
+	check(get(0x80, GET_DESCRIPTOR, 0x0200, 0, 255) == n,
+	      "a request after a stall");
+
+	check(!stub_endpoint_errors, "no endpoint errors");
+	check( usb_host_com_max_accesses <= ACCESSES_BUDGET,
+	       "the interrupt within its budget" );
+
+	printf( "%u runs of the endpoint 0 interrupt:  at most %u register "
+	        "accesses each (budget %u), and no waiting\n",
+	        usb_host_com_calls, usb_host_com_max_accesses,
+	        ACCESSES_BUDGET );
+	return 0;
+}
+
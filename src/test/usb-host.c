@@ -0,0 +1,276 @@
+/* ----------------------------------------------------------------------------
+ * an emulated USB host : code
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#define USB_SERIAL_PRIVATE_INCLUDE
+#include "../usb_keyboard_rawhid.h"
+#include "./usb-host.h"
+
+// ----------------------------------------------------------------------------
+
+// how many times in a row the endpoint 0 interrupt may run for one packet
+// (more means it's stuck)
+#define  COM_CALLS_MAX  16
+// register accesses one run of an interrupt may make before it counts as
+// waiting forever
+#define  ACCESSES_MAX   10000
+
+#define  ENDPOINT0_SIZE  32
+
+// ----------------------------------------------------------------------------
+
+void USB_GEN_vect(void);
+void USB_COM_vect(void);
+
+uint8_t  usb_host_interval[STUB_ENDPOINTS];
+uint32_t usb_host_frames;
+
+uint32_t usb_host_com_calls;
+uint32_t usb_host_com_max_accesses;
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Run `vector`, stopping the program if it waits forever
+ *
+ * Returns
+ * - the register accesses it made
+ */
+static uint32_t run(void (*vector)(void)) {
+	uint32_t before = stub_endpoint_accesses;
+
+	stub_endpoints_settle();
+	stub_endpoint_access_limit = before + ACCESSES_MAX;
+	vector();
+	stub_endpoint_access_limit = 0;
+	stub_endpoints_settle();
+	return stub_endpoint_accesses - before;
+}
+
+/*
+ * Deliver the endpoint 0 interrupt for as long as it's enabled and pending
+ */
+static void com(void) {
+	for (uint8_t n=0; n<COM_CALLS_MAX; n++) {
+		stub_endpoints_settle();
+		stub_endpoint_t * ep0 = &stub_endpoints[0];
+		// the enable bits are in the same places as the flags
+		if (!( ep0->ueienx & ep0->shown
+		       & ((1<<RXSTPI) | (1<<RXOUTI) | (1<<TXINI)) ))
+			return;
+
+		uint32_t accesses = run(USB_COM_vect);
+		usb_host_com_calls++;
+		if (accesses > usb_host_com_max_accesses)
+			usb_host_com_max_accesses = accesses;
+	}
+}
+
+static bool stalled(void) {
+	return stub_endpoints[0].ueconx & (1<<STALLRQ);
+}
+
+/*
+ * Take the oldest full IN bank of `endpoint` into `data` (if not NULL)
+ *
+ * Returns
+ * - the packet's length, or -1 if there was none
+ */
+static int8_t take(uint8_t endpoint, uint8_t * data) {
+	stub_endpoints_settle();
+	stub_banks_t * b     = &stub_endpoints[endpoint].in;
+	uint8_t        banks = stub_endpoint_banks(endpoint);
+
+	if (!b->full)
+		return -1;
+	uint8_t length = b->length[b->first];
+	if (data)
+		memcpy(data, b->data[b->first], length);
+	b->first = (b->first + 1) % banks;
+	b->full--;
+	stub_endpoints_settle();
+	return length;
+}
+
+/*
+ * Fill an OUT bank of `endpoint` (with a SETUP packet, if `setup`)
+ *
+ * Returns
+ * - whether there was a free one
+ */
+static bool put( uint8_t endpoint, const uint8_t * data, uint8_t length,
+                 bool setup ) {
+	stub_endpoints_settle();
+	stub_endpoint_t * ep    = &stub_endpoints[endpoint];
+	uint8_t           banks = stub_endpoint_banks(endpoint);
+
+	if (ep->out.full == banks)
+		return false;
+	uint8_t bank = (ep->out.first + ep->out.full) % banks;
+	if (length)
+		memcpy(ep->out.data[bank], data, length);
+	ep->out.length[bank] = length;
+	ep->out.full++;
+	ep->setup = setup;
+	stub_endpoints_settle();
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Reset the bus, and set the device up as a host would (reading the
+ * `bInterval`s on the way)
+ *
+ * Returns
+ * - whether the device ended up configured
+ */
+bool usb_host_enumerate(void) {
+	uint8_t  d[255];
+	uint16_t length;
+
+	memset(stub_endpoints, 0, sizeof(stub_endpoints));
+	memset(usb_host_interval, 0, sizeof(usb_host_interval));
+	usb_host_frames = 0;
+	UDINT = (1<<EORSTI);
+	run(USB_GEN_vect);
+
+	if (usb_host_control(0x80, GET_DESCRIPTOR, 0x0100, 0, 18, d) != 18)
+		return false;
+	if (usb_host_control(0x00, SET_ADDRESS, 7, 0, 0, NULL))
+		return false;
+	if ((UDADDR & 0x7F) != 7)
+		return false;
+	if (usb_host_control(0x80, GET_DESCRIPTOR, 0x0200, 0, 9, d) != 9)
+		return false;
+	length = d[2] | (d[3] << 8);
+	if (length > sizeof(d))
+		return false;
+	if (usb_host_control(0x80, GET_DESCRIPTOR, 0x0200, 0, length, d)
+	    != length)
+		return false;
+	for (uint16_t i=0; i+1<length && d[i]; i+=d[i]) {
+		uint8_t endpoint = (d[i+2] & 0x7F) % STUB_ENDPOINTS;
+		if (d[i+1] == 5)  // an endpoint descriptor
+			usb_host_interval[endpoint] = d[i+6];
+	}
+	if (usb_host_control(0x00, SET_CONFIGURATION, 1, 0, 0, NULL))
+		return false;
+
+	// the driver reset the other endpoints (`UERST`)
+	for (uint8_t e=1; e<STUB_ENDPOINTS; e++) {
+		memset(&stub_endpoints[e].in,  0, sizeof(stub_banks_t));
+		memset(&stub_endpoints[e].out, 0, sizeof(stub_banks_t));
+	}
+	stub_endpoints_settle();
+	return usb_configured();
+}
+
+/*
+ * Carry out a control transfer on endpoint 0
+ *
+ * Arguments
+ * - data: what to send, or where to put what's received (`wLength` bytes)
+ *
+ * Returns
+ * - the bytes received or sent, `USB_HOST_STALL`, or `USB_HOST_NO_REPLY`
+ */
+int16_t usb_host_control( uint8_t bmRequestType, uint8_t bRequest,
+                          uint16_t wValue, uint16_t wIndex,
+                          uint16_t wLength, uint8_t * data ) {
+	uint8_t  setup[8] = { bmRequestType, bRequest,
+	                      wValue & 0xFF,  wValue >> 8,
+	                      wIndex & 0xFF,  wIndex >> 8,
+	                      wLength & 0xFF, wLength >> 8 };
+	uint8_t  packet[ENDPOINT0_SIZE];
+	uint16_t done = 0;
+	int8_t   n;
+
+	// a SETUP clears a stall, and whatever was left of the last transfer
+	stub_endpoints[0].ueconx &= ~(1<<STALLRQ);
+	memset(&stub_endpoints[0].in,  0, sizeof(stub_banks_t));
+	memset(&stub_endpoints[0].out, 0, sizeof(stub_banks_t));
+	put(0, setup, sizeof(setup), true);
+	com();
+
+	if (bmRequestType & 0x80) {
+		do {
+			com();
+			if (stalled())
+				return USB_HOST_STALL;
+			n = take(0, packet);
+			if (n < 0)
+				return USB_HOST_NO_REPLY;
+			if (n > wLength - done)
+				n = wLength - done;
+			memcpy(data + done, packet, n);
+			done += n;
+		} while (n == ENDPOINT0_SIZE && done < wLength);
+
+		// status: an empty OUT packet (the controller takes it, if
+		// there's room, whether the firmware looks at it or not)
+		if (!put(0, NULL, 0, false))
+			return USB_HOST_NO_REPLY;
+		com();
+		return done;
+	}
+
+	while (done < wLength) {
+		n = (wLength - done < ENDPOINT0_SIZE)
+		    ? wLength - done : ENDPOINT0_SIZE;
+		com();
+		if (stalled())
+			return USB_HOST_STALL;
+		if (!put(0, data + done, n, false))
+			return USB_HOST_NO_REPLY;
+		done += n;
+	}
+
+	// status: an empty IN packet
+	com();
+	if (stalled())
+		return USB_HOST_STALL;
+	if (take(0, NULL) != 0)
+		return USB_HOST_NO_REPLY;
+	com();  // for anything waiting on the status being taken
+	return done;
+}
+
+/*
+ * Start a frame: the start of frame interrupt
+ */
+void usb_host_frame(void) {
+	UDINT |= (1<<SOFI);
+	run(USB_GEN_vect);
+	usb_host_frames++;
+}
+
+/*
+ * Poll an IN endpoint (other than 0) once
+ *
+ * Returns
+ * - the length of the packet it sent, or -1 if it had none (a NAK)
+ */
+int8_t usb_host_in(uint8_t endpoint, uint8_t * data) {
+	return take(endpoint, data);
+}
+
+/*
+ * Send a packet to an OUT endpoint (other than 0)
+ *
+ * Returns
+ * - whether it had room (or else NAKed)
+ */
+bool usb_host_out(uint8_t endpoint, const uint8_t * data, uint8_t length) {
+	return put(endpoint, data, length, false);
+}
+
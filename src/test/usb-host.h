@@ -0,0 +1,47 @@
+/* ----------------------------------------------------------------------------
+ * an emulated USB host : exports
+ *
+ * Talks to the firmware's USB driver through the stand-in endpoint registers
+ * (see "stub/registers.c"), calling its interrupt handlers where the hardware
+ * would.  Time is counted in frames (1 ms each), and moves only when a test
+ * calls `usb_host_frame()`.
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2012 Ben Blazak <benblazak.dev@gmail.com>
+ * Released under The MIT License (MIT) (see "license.md")
+ * Project located at <https://github.com/benblazak/ergodox-firmware>
+ * ------------------------------------------------------------------------- */
+
+
+#ifndef TEST__USB_HOST_h
+	#define TEST__USB_HOST_h
+
+	#include <stdbool.h>
+	#include <stdint.h>
+	#include <avr/io.h>
+
+	// --------------------------------------------------------------------
+
+	#define USB_HOST_STALL    -1  // the device stalled the request
+	#define USB_HOST_NO_REPLY -2  // the device never answered
+
+	// `bInterval` for each endpoint, from the configuration descriptor
+	extern uint8_t  usb_host_interval[STUB_ENDPOINTS];
+	// frames since the bus reset
+	extern uint32_t usb_host_frames;
+
+	// the endpoint 0 interrupt: how many times it ran, and the most
+	// register accesses (see "stub/avr/io.h") any one run made
+	extern uint32_t usb_host_com_calls;
+	extern uint32_t usb_host_com_max_accesses;
+
+	bool    usb_host_enumerate (void);
+	int16_t usb_host_control   ( uint8_t bmRequestType, uint8_t bRequest,
+	                             uint16_t wValue, uint16_t wIndex,
+	                             uint16_t wLength, uint8_t * data );
+	void    usb_host_frame     (void);
+	int8_t  usb_host_in        (uint8_t endpoint, uint8_t * data);
+	bool    usb_host_out       ( uint8_t endpoint,
+	                             const uint8_t * data, uint8_t length );
+
+#endif
+
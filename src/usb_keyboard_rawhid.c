@@ -30,6 +30,7 @@
 // Version 1.1: Add support for Teensy 2.0
 
 #define USB_SERIAL_PRIVATE_INCLUDE
+#include <stddef.h>
 #include "usb_keyboard_rawhid.h"
 
 /**************************************************************************
@@ -60,18 +61,18 @@
 #define REPORT_ID_SYSTEM    2
 #define REPORT_ID_CONSUMER  3
 
-// TODO: What these values are?
-// #define RAWHID_USAGE_PAGE	0xFFAB	// recommended: 0xFF00 to 0xFFFF
-// #define RAWHID_USAGE		0x0200	// recommended: 0x0100 to 0xFFFF
+// The raw HID interface is vendor defined: the host finds it by this usage
+// page and usage (see "build-scripts/telemetry.py"), not by what it does.
+#define RAWHID_USAGE_PAGE	0xFFAB	// recommended: 0xFF00 to 0xFFFF
+#define RAWHID_USAGE		0x0200	// recommended: 0x0100 to 0xFFFF
 
 // These determine the bandwidth that will be allocated
 // for your communication.  You do not need to use it
 // all, but allocating more than necessary means reserved
 // bandwidth is no longer available to other USB devices.
-// #define RAWHID_TX_SIZE		64	// transmit packet size
-// #define RAWHID_TX_INTERVAL	2	// max # of ms between transmit packets
-// #define RAWHID_RX_SIZE		64	// receive packet size
-// #define RAWHID_RX_INTERVAL	8	// max # of ms between receive packets
+// (RAWHID_TX_SIZE and RAWHID_RX_SIZE are in the header.)
+#define RAWHID_TX_INTERVAL	2	// max # of ms between transmit packets
+#define RAWHID_RX_INTERVAL	8	// max # of ms between receive packets
 
 
 /**************************************************************************
@@ -83,26 +84,38 @@
 
 #define KEYBOARD_INTERFACE	0
 #define KEYBOARD_ENDPOINT	1
-#define KEYBOARD_SIZE		8
+#define KEYBOARD_SIZE		32	// holds a report protocol report
+#define KEYBOARD_INTERVAL	MAKEFILE_USB_POLL_INTERVAL	// in ms
 #define KEYBOARD_BUFFER		EP_DOUBLE_BUFFER
 
 #define EXTRA_INTERFACE		1
 #define EXTRA_ENDPOINT		2
-#define EXTRA_SIZE		8
+#define EXTRA_SIZE		16	// holds a consumer report
+#define EXTRA_INTERVAL		MAKEFILE_USB_POLL_INTERVAL	// in ms
 #define EXTRA_BUFFER		EP_DOUBLE_BUFFER
 
-// #define RAWHID_INTERFACE	2
-// #define RAWHID_TX_ENDPOINT	3
-// #define RAWHID_RX_ENDPOINT	4
-// #define RAWHID_TX_BUFFER	EP_DOUBLE_BUFFER
-// #define RAWHID_RX_BUFFER	EP_DOUBLE_BUFFER
+#define RAWHID_INTERFACE	2
+#define RAWHID_TX_ENDPOINT	3
+#define RAWHID_RX_ENDPOINT	4
+#define RAWHID_TX_BUFFER	EP_DOUBLE_BUFFER
+#define RAWHID_RX_BUFFER	EP_DOUBLE_BUFFER
+
+#if MAKEFILE_DEBUG_CONSOLE
+#define DEBUG_INTERFACE		3
+#define DEBUG_TX_ENDPOINT	5
+#define DEBUG_TX_SIZE		32	// what hid_listen expects
+#define DEBUG_TX_INTERVAL	1
+#define DEBUG_TX_BUFFER		EP_DOUBLE_BUFFER
+#endif
 
 static const uint8_t PROGMEM endpoint_config_table[] = {
 	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(KEYBOARD_SIZE) | KEYBOARD_BUFFER,
 	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(EXTRA_SIZE)    | EXTRA_BUFFER,    // 4
-	// 1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(RAWHID_TX_SIZE) | RAWHID_TX_BUFFER,
-	// 1, EP_TYPE_INTERRUPT_OUT,  EP_SIZE(RAWHID_RX_SIZE) | RAWHID_RX_BUFFER,
-	0
+	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(RAWHID_TX_SIZE) | RAWHID_TX_BUFFER,
+	1, EP_TYPE_INTERRUPT_OUT, EP_SIZE(RAWHID_RX_SIZE) | RAWHID_RX_BUFFER,
+#if MAKEFILE_DEBUG_CONSOLE
+	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(DEBUG_TX_SIZE)  | DEBUG_TX_BUFFER,
+#endif
 };
 
 
@@ -137,7 +150,10 @@ static const uint8_t PROGMEM device_descriptor[] = {
 };
 
 
-// Keyboard Protocol 1, HID 1.11 spec, Appendix B, page 59-60
+// Keyboard Protocol 1, HID 1.11 spec, Appendix B, page 59-60, but with a
+// bitmap of keys instead of an array of 6 (for n-key rollover).  Hosts that
+// select the boot protocol (BIOSes) don't read this, and are sent the boot
+// report from Appendix B instead.
 static const uint8_t PROGMEM keyboard_hid_report_desc[] = {
         0x05, 0x01,          // Usage Page (Generic Desktop),
         0x09, 0x06,          // Usage (Keyboard),
@@ -150,9 +166,6 @@ static const uint8_t PROGMEM keyboard_hid_report_desc[] = {
         0x15, 0x00,          //   Logical Minimum (0),
         0x25, 0x01,          //   Logical Maximum (1),
         0x81, 0x02,          //   Input (Data, Variable, Absolute), ;Modifier byte
-        0x95, 0x01,          //   Report Count (1),
-        0x75, 0x08,          //   Report Size (8),
-        0x81, 0x03,          //   Input (Constant),                 ;Reserved byte
         0x95, 0x05,          //   Report Count (5),
         0x75, 0x01,          //   Report Size (1),
         0x05, 0x08,          //   Usage Page (LEDs),
@@ -162,20 +175,33 @@ static const uint8_t PROGMEM keyboard_hid_report_desc[] = {
         0x95, 0x01,          //   Report Count (1),
         0x75, 0x03,          //   Report Size (3),
         0x91, 0x03,          //   Output (Constant),                 ;LED report padding
-        0x95, 0x06,          //   Report Count (6),
-        0x75, 0x08,          //   Report Size (8),
+        0x95, KEYBOARD_KEYS_BYTES*8, //   Report Count (224),
+        0x75, 0x01,          //   Report Size (1),
         0x15, 0x00,          //   Logical Minimum (0),
-        0x25, 0x68,          //   Logical Maximum(104),
+        0x25, 0x01,          //   Logical Maximum (1),
         0x05, 0x07,          //   Usage Page (Key Codes),
         0x19, 0x00,          //   Usage Minimum (0),
-        0x29, 0x68,          //   Usage Maximum (104),
-        0x81, 0x00,          //   Input (Data, Array),
+        0x29, KEYBOARD_KEYS_BYTES*8-1, // Usage Maximum (223),
+        0x81, 0x02,          //   Input (Data, Variable, Absolute), ;Key bitmap
         0xc0                 // End Collection
 };
 
 // audio controls & system controls
 // http://www.microsoft.com/whdc/archive/w2kbd.mspx
 static const uint8_t PROGMEM extra_hid_report_desc[] = {
+    /* system control */
+    0x05, 0x01,                    // USAGE_PAGE (Generic Desktop)
+    0x09, 0x80,                    // USAGE (System Control)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x85, REPORT_ID_SYSTEM,        //   REPORT_ID (2)
+    0x15, 0x01,                    //   LOGICAL_MINIMUM (0x1)
+    0x26, 0xb7, 0x00,              //   LOGICAL_MAXIMUM (0xb7)
+    0x19, 0x01,                    //   USAGE_MINIMUM (0x1)
+    0x29, 0xb7,                    //   USAGE_MAXIMUM (0xb7)
+    0x75, 0x10,                    //   REPORT_SIZE (16)
+    0x95, 0x01,                    //   REPORT_COUNT (1)
+    0x81, 0x00,                    //   INPUT (Data,Array,Abs)
+    0xc0,                          // END_COLLECTION
     /* consumer */
     0x05, 0x0c,                    // USAGE_PAGE (Consumer Devices)
     0x09, 0x01,                    // USAGE (Consumer Control)
@@ -186,26 +212,42 @@ static const uint8_t PROGMEM extra_hid_report_desc[] = {
     0x19, 0x01,                    //   USAGE_MINIMUM (0x1)
     0x2a, 0x9c, 0x02,              //   USAGE_MAXIMUM (0x29c)
     0x75, 0x10,                    //   REPORT_SIZE (16)
-    0x95, 0x01,                    //   REPORT_COUNT (1)
+    0x95, CONSUMER_KEYS,           //   REPORT_COUNT
     0x81, 0x00,                    //   INPUT (Data,Array,Abs)
     0xc0,                          // END_COLLECTION
 };
 
-// static const uint8_t PROGMEM rawhid_hid_report_desc[] = {
-// 	0x06, LSB(RAWHID_USAGE_PAGE), MSB(RAWHID_USAGE_PAGE),
-// 	0x0A, LSB(RAWHID_USAGE), MSB(RAWHID_USAGE),
-// 	0xA1, 0x01,				// Collection 0x01
-// 	0x75, 0x08,				// report size = 8 bits
-// 	0x15, 0x00,				// logical minimum = 0
-// 	0x26, 0xFF, 0x00,			// logical maximum = 255
-// 	0x95, RAWHID_TX_SIZE,			// report count
-// 	0x09, 0x01,				// usage
-// 	0x81, 0x02,				// Input (array)
-// 	0x95, RAWHID_RX_SIZE,			// report count
-// 	0x09, 0x02,				// usage
-// 	0x91, 0x02,				// Output (array)
-// 	0xC0					// end collection
-// };
+static const uint8_t PROGMEM rawhid_hid_report_desc[] = {
+	0x06, LSB(RAWHID_USAGE_PAGE), MSB(RAWHID_USAGE_PAGE),
+	0x0A, LSB(RAWHID_USAGE), MSB(RAWHID_USAGE),
+	0xA1, 0x01,				// Collection 0x01
+	0x75, 0x08,				// report size = 8 bits
+	0x15, 0x00,				// logical minimum = 0
+	0x26, 0xFF, 0x00,			// logical maximum = 255
+	0x95, RAWHID_TX_SIZE,			// report count
+	0x09, 0x01,				// usage
+	0x81, 0x02,				// Input (array)
+	0x95, RAWHID_RX_SIZE,			// report count
+	0x09, 0x02,				// usage
+	0x91, 0x02,				// Output (array)
+	0xC0					// end collection
+};
+
+#if MAKEFILE_DEBUG_CONSOLE
+// the usage page and usage PJRC's hid_listen looks for
+static const uint8_t PROGMEM debug_hid_report_desc[] = {
+	0x06, 0x31, 0xFF,			// Usage Page 0xFF31 (vendor defined)
+	0x09, 0x74,				// Usage 0x74
+	0xA1, 0x53,				// Collection 0x53
+	0x75, 0x08,				// report size = 8 bits
+	0x15, 0x00,				// logical minimum = 0
+	0x26, 0xFF, 0x00,			// logical maximum = 255
+	0x95, DEBUG_TX_SIZE,			// report count
+	0x09, 0x75,				// usage
+	0x81, 0x02,				// Input (array)
+	0xC0					// end collection
+};
+#endif
 
 #define KEYBOARD_HID_DESC_NUM           0
 #define KEYBOARD_HID_DESC_OFFSET        (9+(9+9+7)*KEYBOARD_HID_DESC_NUM+9)
@@ -213,10 +255,16 @@ static const uint8_t PROGMEM extra_hid_report_desc[] = {
 #define EXTRA_HID_DESC_NUM              (KEYBOARD_HID_DESC_NUM + 1)
 #define EXTRA_HID_DESC_OFFSET           (9+(9+9+7)*EXTRA_HID_DESC_NUM+9)
 
-// #define RAWHID_HID_DESC_NUM             (EXTRA_HID_DESC_NUM + 1)
-// #define RAWHID_HID_DESC_OFFSET          (9+(9+9+7)*RAWHID_HID_DESC_NUM+9)
+#define RAWHID_HID_DESC_NUM             (EXTRA_HID_DESC_NUM + 1)
+#define RAWHID_HID_DESC_OFFSET          (9+(9+9+7)*RAWHID_HID_DESC_NUM+9)
 
-#define NUM_INTERFACES                  (EXTRA_HID_DESC_NUM + 1)
+#if MAKEFILE_DEBUG_CONSOLE
+#define DEBUG_HID_DESC_NUM              (RAWHID_HID_DESC_NUM + 1)
+#define DEBUG_HID_DESC_OFFSET           (9+(9+9+7)*DEBUG_HID_DESC_NUM+7+9)
+#define NUM_INTERFACES                  (DEBUG_HID_DESC_NUM + 1)
+#else
+#define NUM_INTERFACES                  (RAWHID_HID_DESC_NUM + 1)
+#endif
 #define CONFIG1_DESC_SIZE               (9+(9+9+7)*NUM_INTERFACES+7)
 //#define KEYBOARD_HID_DESC_OFFSET (9+9)
 static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
@@ -255,7 +303,7 @@ static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	KEYBOARD_ENDPOINT | 0x80,			// bEndpointAddress
 	0x03,					// bmAttributes (0x03=intr)
 	KEYBOARD_SIZE, 0,				// wMaxPacketSize
-	10,					// bInterval
+	KEYBOARD_INTERVAL,			// bInterval
 
 	// interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
 	9,					// bLength
@@ -282,41 +330,70 @@ static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	EXTRA_ENDPOINT | 0x80,			// bEndpointAddress
 	0x03,					// bmAttributes (0x03=intr)
 	EXTRA_SIZE, 0,				// wMaxPacketSize
-	10,					// bInterval
+	EXTRA_INTERVAL,				// bInterval
+
+	// interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
+	9,					// bLength
+	4,					// bDescriptorType
+	RAWHID_INTERFACE,			// bInterfaceNumber
+	0,					// bAlternateSetting
+	2,					// bNumEndpoints
+	0x03,					// bInterfaceClass (0x03 = HID)
+	0x00,					// bInterfaceSubClass
+	0x00,					// bInterfaceProtocol
+	0,					// iInterface
+	// HID interface descriptor, HID 1.11 spec, section 6.2.1
+	9,					// bLength
+	0x21,					// bDescriptorType
+	0x11, 0x01,				// bcdHID
+	0,					// bCountryCode
+	1,					// bNumDescriptors
+	0x22,					// bDescriptorType
+	sizeof(rawhid_hid_report_desc),		// wDescriptorLength
+	0,
+	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+	7,					// bLength
+	5,					// bDescriptorType
+	RAWHID_TX_ENDPOINT | 0x80,		// bEndpointAddress
+	0x03,					// bmAttributes (0x03=intr)
+	RAWHID_TX_SIZE, 0,			// wMaxPacketSize
+	RAWHID_TX_INTERVAL,			// bInterval
+	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+	7,					// bLength
+	5,					// bDescriptorType
+	RAWHID_RX_ENDPOINT,			// bEndpointAddress
+	0x03,					// bmAttributes (0x03=intr)
+	RAWHID_RX_SIZE, 0,			// wMaxPacketSize
+	RAWHID_RX_INTERVAL,			// bInterval
 
+#if MAKEFILE_DEBUG_CONSOLE
 	// interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
-	// 9,					// bLength
-	// 4,					// bDescriptorType
-	// RAWHID_INTERFACE,			// bInterfaceNumber
-	// 0,					// bAlternateSetting
-	// 2,					// bNumEndpoints
-	// 0x03,					// bInterfaceClass (0x03 = HID)
-	// 0x00,					// bInterfaceSubClass (0x01 = Boot)
-	// 0x00,					// bInterfaceProtocol (0x01 = Keyboard)
-	// 0,					// iInterface
-	// // HID interface descriptor, HID 1.11 spec, section 6.2.1
-	// 9,					// bLength
-	// 0x21,					// bDescriptorType
-	// 0x11, 0x01,				// bcdHID
-	// 0,					// bCountryCode
-	// 1,					// bNumDescriptors
-	// 0x22,					// bDescriptorType
-	// sizeof(rawhid_hid_report_desc),		// wDescriptorLength
-	// 0,
-	// // endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
-	// 7,					// bLength
-	// 5,					// bDescriptorType
-	// RAWHID_TX_ENDPOINT | 0x80,		// bEndpointAddress
-	// 0x03,					// bmAttributes (0x03=intr)
-	// RAWHID_TX_SIZE, 0,			// wMaxPacketSize
-	// RAWHID_TX_INTERVAL,			// bInterval
-	// // endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
-	// 7,					// bLength
-	// 5,					// bDescriptorType
-	// RAWHID_RX_ENDPOINT,			// bEndpointAddress
-	// 0x03,					// bmAttributes (0x03=intr)
-	// RAWHID_RX_SIZE, 0,			// wMaxPacketSize
-	// RAWHID_RX_INTERVAL			// bInterval
+	9,					// bLength
+	4,					// bDescriptorType
+	DEBUG_INTERFACE,			// bInterfaceNumber
+	0,					// bAlternateSetting
+	1,					// bNumEndpoints
+	0x03,					// bInterfaceClass (0x03 = HID)
+	0x00,					// bInterfaceSubClass
+	0x00,					// bInterfaceProtocol
+	0,					// iInterface
+	// HID interface descriptor, HID 1.11 spec, section 6.2.1
+	9,					// bLength
+	0x21,					// bDescriptorType
+	0x11, 0x01,				// bcdHID
+	0,					// bCountryCode
+	1,					// bNumDescriptors
+	0x22,					// bDescriptorType
+	sizeof(debug_hid_report_desc),		// wDescriptorLength
+	0,
+	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+	7,					// bLength
+	5,					// bDescriptorType
+	DEBUG_TX_ENDPOINT | 0x80,		// bEndpointAddress
+	0x03,					// bmAttributes (0x03=intr)
+	DEBUG_TX_SIZE, 0,			// wMaxPacketSize
+	DEBUG_TX_INTERVAL,			// bInterval
+#endif
 };
 
 // If you're desperate for a little extra code memory, these strings
@@ -325,7 +402,7 @@ static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 struct usb_string_descriptor_struct {
 	uint8_t bLength;
 	uint8_t bDescriptorType;
-	int16_t wString[];
+	wchar_t wString[];	// the type of L"" strings (16 bit on the AVR)
 };
 static const struct usb_string_descriptor_struct PROGMEM string0 = {
 	4,
@@ -343,33 +420,32 @@ static const struct usb_string_descriptor_struct PROGMEM string2 = {
 	STR_PRODUCT
 };
 
-// This table defines which descriptor data is sent for each specific
-// request from the host (in wValue and wIndex).
-static struct descriptor_list_struct {
-	uint16_t	wValue;
-	uint16_t	wIndex;
+// These tables give the descriptor data sent for each request from the
+// host, indexed by the descriptor index (in the low byte of wValue) for
+// strings, and by the interface (in wIndex) for HID descriptors, so
+// usb_descriptor() can find any of them without searching.
+static struct hid_desc_struct {
+	uint8_t		offset;		// of the HID descriptor, in config1
+	const uint8_t	*report;
+	uint8_t		report_length;
+} const PROGMEM hid_desc_list[NUM_INTERFACES] = {
+	[KEYBOARD_INTERFACE] = {KEYBOARD_HID_DESC_OFFSET, keyboard_hid_report_desc, sizeof(keyboard_hid_report_desc)},
+	[EXTRA_INTERFACE] = {EXTRA_HID_DESC_OFFSET, extra_hid_report_desc, sizeof(extra_hid_report_desc)},
+	[RAWHID_INTERFACE] = {RAWHID_HID_DESC_OFFSET, rawhid_hid_report_desc, sizeof(rawhid_hid_report_desc)},
+#if MAKEFILE_DEBUG_CONSOLE
+	[DEBUG_INTERFACE] = {DEBUG_HID_DESC_OFFSET, debug_hid_report_desc, sizeof(debug_hid_report_desc)},
+#endif
+};
+
+static struct string_desc_struct {
 	const uint8_t	*addr;
 	uint8_t		length;
-} const PROGMEM descriptor_list[] = {
-        // DEVICE descriptor
-	{0x0100, 0x0000, device_descriptor, sizeof(device_descriptor)},
-        // CONFIGURATION descriptor
-	{0x0200, 0x0000, config1_descriptor, sizeof(config1_descriptor)},
-        // HID/REPORT descriptors
-	{0x2100, KEYBOARD_INTERFACE, config1_descriptor+KEYBOARD_HID_DESC_OFFSET, 9},
-	{0x2200, KEYBOARD_INTERFACE, keyboard_hid_report_desc, sizeof(keyboard_hid_report_desc)},
-	    // Extra HID Descriptor
-	{0x2100, EXTRA_INTERFACE, config1_descriptor+EXTRA_HID_DESC_OFFSET, 9},
-	{0x2200, EXTRA_INTERFACE, extra_hid_report_desc, sizeof(extra_hid_report_desc)},
-        // RAWHID HID Descriptors
-	// {0x2100, RAWHID_INTERFACE, config1_descriptor+RAWHID_HID_DESC_OFFSET, 9},
-	// {0x2200, RAWHID_INTERFACE, rawhid_hid_report_desc, sizeof(rawhid_hid_report_desc)},
-        // STRING descriptors
-	{0x0300, 0x0000, (const uint8_t *)&string0, 4},
-	{0x0301, 0x0409, (const uint8_t *)&string1, sizeof(STR_MANUFACTURER)},
-	{0x0302, 0x0409, (const uint8_t *)&string2, sizeof(STR_PRODUCT)}
+} const PROGMEM string_list[] = {
+	{(const uint8_t *)&string0, 4},
+	{(const uint8_t *)&string1, sizeof(STR_MANUFACTURER)},
+	{(const uint8_t *)&string2, sizeof(STR_PRODUCT)}
 };
-#define NUM_DESC_LIST (sizeof(descriptor_list)/sizeof(struct descriptor_list_struct))
+#define NUM_STRINGS (sizeof(string_list)/sizeof(struct string_desc_struct))
 
 
 /**************************************************************************
@@ -381,32 +457,112 @@ static struct descriptor_list_struct {
 // zero when we are not configured, non-zero when enumerated
 static volatile uint8_t usb_configuration=0;
 
+// a control transfer that takes more than one endpoint 0 interrupt.  the
+// interrupt for the request starts it, and enables the endpoint 0
+// interrupt for whatever it waits on next, so each interrupt handles at
+// most one packet, instead of waiting inside the interrupt for the host.
+#define EP0_IDLE		0
+#define EP0_DESCRIPTOR		1	// sending ep0_addr, ep0_len bytes left
+#define EP0_STATUS		2	// sent; waiting for the host's OUT status
+#define EP0_SET_ADDRESS		3	// waiting for the host to take our status
+#define EP0_SET_REPORT		4	// waiting for the keyboard LED report
+#define EP0_ZEROS		5	// like EP0_DESCRIPTOR, but sending zeros
+#define EP0_DISCARD		6	// reading ep0_len bytes, to be ignored
+static uint8_t ep0_state=EP0_IDLE;
+static const uint8_t *ep0_addr;
+static uint8_t ep0_len;
+static uint8_t ep0_address;
+
 // which modifier keys are currently pressed
 // 1=left ctrl,    2=left shift,   4=left alt,    8=left gui
 // 16=right ctrl, 32=right shift, 64=right alt, 128=right gui
 uint8_t keyboard_modifier_keys=0;
 
-// which keys are currently pressed, up to 6 keys may be down at once
-uint8_t keyboard_keys[6]={0,0,0,0,0,0};
+// which keys are currently pressed, as a bitmap (any number may be down)
+uint8_t keyboard_keys[KEYBOARD_KEYS_BYTES];
 
-// protocol setting from the host.  We use exactly the same report
-// either way, so this variable only stores the setting since we
-// are required to be able to report which setting is in use.
-static uint8_t keyboard_protocol=1;
+// protocol setting from the host.  0 (boot): reports are sent in the boot
+// format, of up to 6 keys; 1 (report, the default): reports are sent as
+// described by keyboard_hid_report_desc, as a bitmap.
+static volatile uint8_t keyboard_protocol=1;
 
 // the idle configuration, how often we send the report to the
-// host (ms * 4) even when it hasn't changed
+// host (ms * 4) even when it hasn't changed; 0 for only when it changes
 static uint8_t keyboard_idle_config=125;
 
-// count until idle timeout
+// time since the last report was sent (ms * 4), up to 255
 static uint8_t keyboard_idle_count=0;
 
+// reports not queued, because they were the same as the last one queued
+// (or, if none are waiting, the last one sent)
+uint16_t keyboard_reports_suppressed=0;
+
+// reports waiting to be sent, oldest at `keyboard_queue_tail`; filled by
+// usb_keyboard_send(), and emptied (one report per frame) by the start of
+// frame interrupt.  the last report sent is kept, for idle resends.  each
+// report has a sequence number, one more than the report before it.
+struct keyboard_report_struct {
+	uint8_t modifier_keys;
+	uint8_t keys[KEYBOARD_KEYS_BYTES];
+	uint8_t seq;	// not sent
+};
+static struct keyboard_report_struct keyboard_queue[KEYBOARD_QUEUE_SIZE];
+static volatile uint8_t keyboard_queue_head=0;
+static volatile uint8_t keyboard_queue_tail=0;
+static struct keyboard_report_struct keyboard_report_sent;
+
+// a report that didn't fit in the queue (or came while we weren't
+// configured), to be queued by the start of frame interrupt as soon as
+// there's room
+static struct keyboard_report_struct keyboard_pending;
+static volatile uint8_t keyboard_pending_full=0;
+
+// sequence numbers of the newest report accepted, and of the last one sent
+uint8_t keyboard_report_seq=0;
+volatile uint8_t keyboard_report_seq_sent=0;
+
+// reports that could not be accepted (the queue and the pending slot were
+// both full), and pending reports that were queued late
+uint16_t keyboard_reports_dropped=0;
+volatile uint16_t keyboard_reports_retried=0;
+
 // 1=num lock, 2=caps lock, 4=scroll lock, 8=compose, 16=kana
 volatile uint8_t keyboard_leds=0;
 
-// which consumer key is currently pressed
-uint16_t consumer_key;
-uint16_t last_consumer_key;
+// which consumer keys (unused slots are 0) and system control key are
+// currently pressed, and what was last queued for each
+uint16_t consumer_keys[CONSUMER_KEYS];
+static uint16_t last_consumer_keys[CONSUMER_KEYS];
+uint16_t system_key;
+static uint16_t last_system_key;
+
+// extra (system control and consumer) reports waiting to be sent, queued by
+// usb_extra_send() and sent from the start of frame interrupt, like the
+// keyboard reports.  a system control report only uses data[0].
+#define EXTRA_QUEUE_SIZE	4	// must be a power of 2 (holds one less)
+struct extra_report_struct {
+	uint8_t report_id;
+	uint16_t data[CONSUMER_KEYS];
+};
+static struct extra_report_struct extra_queue[EXTRA_QUEUE_SIZE];
+static volatile uint8_t extra_queue_head=0;
+static volatile uint8_t extra_queue_tail=0;
+
+#if MAKEFILE_DEBUG_CONSOLE
+// debug output waiting to be sent, oldest at debug_tail; filled by
+// usb_debug_putchar(), and emptied a packet per frame by the start of frame
+// interrupt.  a partial packet waits DEBUG_FLUSH_FRAMES for more, unless
+// the output was flushed.
+#define DEBUG_BUFFER_SIZE	128	// must be a power of 2 (holds one less)
+#define DEBUG_FLUSH_FRAMES	4
+static uint8_t debug_buffer[DEBUG_BUFFER_SIZE];
+static volatile uint8_t debug_head=0;
+static volatile uint8_t debug_tail=0;
+static volatile uint8_t debug_flush=0;
+
+// bytes not queued, because the buffer was full
+uint16_t usb_debug_dropped=0;
+#endif
 
 // these are a more reliable timeout than polling the
 // frame counter (UDFNUML)
@@ -420,6 +576,18 @@ uint16_t last_consumer_key;
  **************************************************************************/
 
 
+// is the given report the same as keyboard_keys and keyboard_modifier_keys
+static uint8_t keyboard_report_equal(const struct keyboard_report_struct *r)
+{
+	uint8_t i;
+
+	if (r->modifier_keys != keyboard_modifier_keys) return 0;
+	for (i=0; i<KEYBOARD_KEYS_BYTES; i++) {
+		if (r->keys[i] != keyboard_keys[i]) return 0;
+	}
+	return 1;
+}
+
 // initialize USB
 void usb_init(void)
 {
@@ -448,487 +616,161 @@ int8_t usb_keyboard_press(uint8_t key, uint8_t modifier)
 	int8_t r;
 
 	keyboard_modifier_keys = modifier;
-	keyboard_keys[0] = key;
+	keyboard_key_set(key);
 	r = usb_keyboard_send();
 	if (r) return r;
 	keyboard_modifier_keys = 0;
-	keyboard_keys[0] = 0;
+	keyboard_key_clear(key);
 	return usb_keyboard_send();
 }
 
-// send the contents of keyboard_keys and keyboard_modifier_keys
+// copy keyboard_keys and keyboard_modifier_keys into a report
+static void keyboard_report_take(struct keyboard_report_struct *r)
+{
+	uint8_t i;
+
+	r->modifier_keys = keyboard_modifier_keys;
+	for (i=0; i<KEYBOARD_KEYS_BYTES; i++) {
+		r->keys[i] = keyboard_keys[i];
+	}
+	r->seq = ++keyboard_report_seq;
+}
+
+// queue the contents of keyboard_keys and keyboard_modifier_keys, to be
+// sent at the next start of frame that the endpoint has a free bank.
+// This never waits.  If the queue is full (or we're not configured), the
+// report is kept in a pending slot, and queued by the start of frame
+// interrupt when there's room.  If that's full too, -1 is returned and the
+// report is not kept (and is counted in keyboard_reports_dropped); the
+// caller's next report carries the current state, and since main() asks
+// for one every scan, the last state always reaches the host.
+// A report the same as the one the host will have seen last is not queued
+// (and is counted in keyboard_reports_suppressed), so this may be called
+// whether or not anything changed; the start of frame interrupt resends
+// the last report, if the host asked for that with HID_SET_IDLE.
 int8_t usb_keyboard_send(void)
 {
-	uint8_t i, intr_state, timeout;
+	uint8_t intr_state, head, last;
+	const struct keyboard_report_struct *r;
 
-	if (!usb_configuration) return -1;
 	intr_state = SREG;
 	cli();
-	UENUM = KEYBOARD_ENDPOINT;
-	timeout = UDFNUML + 50;
-	while (1) {
-		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
+	head = keyboard_queue_head;
+	if (keyboard_pending_full) {
+		r = &keyboard_pending;
+	} else if (head != keyboard_queue_tail) {
+		last = (head - 1) & (KEYBOARD_QUEUE_SIZE - 1);
+		r = &keyboard_queue[last];
+	} else {
+		r = &keyboard_report_sent;
+	}
+	if (keyboard_report_equal(r)) {
+		keyboard_reports_suppressed++;
 		SREG = intr_state;
-		// has the USB gone offline?
-		if (!usb_configuration) return -1;
-		// have we waited too long?
-		if (UDFNUML == timeout) return -1;
-		// get ready to try checking again
-		intr_state = SREG;
-		cli();
-		UENUM = KEYBOARD_ENDPOINT;
+		return 0;
 	}
-	UEDATX = keyboard_modifier_keys;
-	UEDATX = 0;
-	for (i=0; i<6; i++) {
-		UEDATX = keyboard_keys[i];
+	if (keyboard_pending_full) {
+		keyboard_reports_dropped++;
+		SREG = intr_state;
+		return -1;
 	}
-	UEINTX = 0x3A;
-	keyboard_idle_count = 0;
+	if (!usb_configuration
+			|| ((head + 1) & (KEYBOARD_QUEUE_SIZE - 1)) == keyboard_queue_tail) {
+		keyboard_report_take(&keyboard_pending);
+		keyboard_pending_full = 1;
+		SREG = intr_state;
+		return 0;
+	}
+	keyboard_report_take(&keyboard_queue[head]);
+	keyboard_queue_head = (head + 1) & (KEYBOARD_QUEUE_SIZE - 1);
 	SREG = intr_state;
 	return 0;
 }
 
-// receive a packet, with timeout
-// int8_t usb_rawhid_recv(uint8_t *buffer, uint8_t timeout)
-// {
-// 	uint8_t intr_state;
-// 
-// 	// if we're not online (enumerated and configured), error
-// 	if (!usb_configuration) return -1;
-// 	intr_state = SREG;
-// 	cli();
-// 	rx_timeout_count = timeout;
-// 	UENUM = RAWHID_RX_ENDPOINT;
-// 	// wait for data to be available in the FIFO
-// 	while (1) {
-// 		if (UEINTX & (1<<RWAL)) break;
-// 		SREG = intr_state;
-// 		if (rx_timeout_count == 0) return 0;
-// 		if (!usb_configuration) return -1;
-// 		intr_state = SREG;
-// 		cli();
-// 		UENUM = RAWHID_RX_ENDPOINT;
-// 	}
-// 	// read bytes from the FIFO
-// 	#if (RAWHID_RX_SIZE >= 64)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 63)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 62)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 61)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 60)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 59)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 58)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 57)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 56)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 55)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 54)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 53)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 52)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 51)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 50)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 49)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 48)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 47)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 46)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 45)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 44)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 43)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 42)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 41)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 40)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 39)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 38)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 37)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 36)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 35)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 34)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 33)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 32)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 31)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 30)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 29)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 28)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 27)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 26)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 25)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 24)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 23)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 22)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 21)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 20)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 19)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 18)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 17)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 16)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 15)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 14)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 13)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 12)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 11)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 10)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 9)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 8)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 7)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 6)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 5)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 4)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 3)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 2)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	#if (RAWHID_RX_SIZE >= 1)
-// 	*buffer++ = UEDATX;
-// 	#endif
-// 	// release the buffer
-// 	UEINTX = 0x6B;
-// 	SREG = intr_state;
-// 	return RAWHID_RX_SIZE;
-// }
-// 
-// // send a packet, with timeout
-// int8_t usb_rawhid_send(const uint8_t *buffer, uint8_t timeout)
-// {
-// 	uint8_t intr_state;
-// 
-// 	// if we're not online (enumerated and configured), error
-// 	if (!usb_configuration) return -1;
-// 	intr_state = SREG;
-// 	cli();
-// 	tx_timeout_count = timeout;
-// 	UENUM = RAWHID_TX_ENDPOINT;
-// 	// wait for the FIFO to be ready to accept data
-// 	while (1) {
-// 		if (UEINTX & (1<<RWAL)) break;
-// 		SREG = intr_state;
-// 		if (tx_timeout_count == 0) return 0;
-// 		if (!usb_configuration) return -1;
-// 		intr_state = SREG;
-// 		cli();
-// 		UENUM = RAWHID_TX_ENDPOINT;
-// 	}
-// 	// write bytes from the FIFO
-// 	#if (RAWHID_TX_SIZE >= 64)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 63)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 62)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 61)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 60)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 59)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 58)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 57)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 56)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 55)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 54)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 53)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 52)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 51)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 50)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 49)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 48)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 47)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 46)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 45)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 44)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 43)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 42)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 41)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 40)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 39)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 38)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 37)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 36)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 35)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 34)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 33)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 32)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 31)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 30)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 29)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 28)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 27)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 26)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 25)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 24)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 23)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 22)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 21)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 20)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 19)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 18)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 17)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 16)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 15)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 14)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 13)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 12)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 11)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 10)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 9)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 8)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 7)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 6)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 5)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 4)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 3)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 2)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	#if (RAWHID_TX_SIZE >= 1)
-// 	UEDATX = *buffer++;
-// 	#endif
-// 	// transmit it now
-// 	UEINTX = 0x3A;
-// 	SREG = intr_state;
-// 	return RAWHID_TX_SIZE;
-// }
+// how many reports are waiting to be sent (including a pending one)
+uint8_t usb_keyboard_queued(void)
+{
+	return ((keyboard_queue_head - keyboard_queue_tail) & (KEYBOARD_QUEUE_SIZE - 1))
+		+ keyboard_pending_full;
+}
+
+#if MAKEFILE_DEBUG_CONSOLE
+// queue a byte of debug output.  This never waits: if the buffer is full,
+// -1 is returned and the byte is dropped (and counted in
+// usb_debug_dropped).
+int8_t usb_debug_putchar(uint8_t c)
+{
+	uint8_t intr_state, head;
+
+	intr_state = SREG;
+	cli();
+	head = (debug_head + 1) & (DEBUG_BUFFER_SIZE - 1);
+	if (head == debug_tail) {
+		usb_debug_dropped++;
+		SREG = intr_state;
+		return -1;
+	}
+	debug_buffer[debug_head] = c;
+	debug_head = head;
+	SREG = intr_state;
+	return 0;
+}
+
+// send the debug output queued so far at the next frame, without waiting
+// to fill a packet
+void usb_debug_flush_output(void)
+{
+	debug_flush = 1;
+}
+#endif
+
+// receive a packet, if one is waiting.  This never waits: 0 is returned
+// if there was none (the host's packet stays with it until there's room),
+// RAWHID_RX_SIZE if one was read into buffer, and -1 if we're not
+// configured.
+int8_t usb_rawhid_recv(uint8_t *buffer)
+{
+	uint8_t i, intr_state;
+
+	if (!usb_configuration) return -1;
+	intr_state = SREG;
+	cli();
+	UENUM = RAWHID_RX_ENDPOINT;
+	if (!(UEINTX & (1<<RWAL))) {
+		SREG = intr_state;
+		return 0;
+	}
+	for (i=0; i<RAWHID_RX_SIZE; i++) {
+		*buffer++ = UEDATX;
+	}
+	// release the buffer
+	UEINTX = 0x6B;
+	SREG = intr_state;
+	return RAWHID_RX_SIZE;
+}
+
+// send a packet, if the endpoint has a free bank.  This never waits: 0 is
+// returned if the packet was not sent (the caller tries again later),
+// RAWHID_TX_SIZE if it was, and -1 if we're not configured.
+int8_t usb_rawhid_send(const uint8_t *buffer)
+{
+	uint8_t i, intr_state;
+
+	if (!usb_configuration) return -1;
+	intr_state = SREG;
+	cli();
+	UENUM = RAWHID_TX_ENDPOINT;
+	if (!(UEINTX & (1<<RWAL))) {
+		SREG = intr_state;
+		return 0;
+	}
+	for (i=0; i<RAWHID_TX_SIZE; i++) {
+		UEDATX = *buffer++;
+	}
+	UEINTX = 0x3A;
+	SREG = intr_state;
+	return RAWHID_TX_SIZE;
+}
 
 /**************************************************************************
  *
@@ -938,13 +780,51 @@ int8_t usb_keyboard_send(void)
 
 
 
+// write a keyboard report to the (already selected) endpoint, in the
+// format for the protocol the host selected.  a boot report holds the first
+// 6 keys pressed (by usage), or, if more are down, 6 ErrorRollOvers.
+static void keyboard_report_data(const struct keyboard_report_struct *r)
+{
+	uint8_t i, bits, code, n=0;
+	uint8_t codes[6];
+
+	UEDATX = r->modifier_keys;
+	if (keyboard_protocol) {
+		for (i=0; i<KEYBOARD_KEYS_BYTES; i++) {
+			UEDATX = r->keys[i];
+		}
+		return;
+	}
+
+	UEDATX = 0;
+	for (i=0; i<KEYBOARD_KEYS_BYTES && n<=6; i++) {
+		bits = r->keys[i];
+		for (code=i*8; bits && n<=6; bits>>=1, code++) {
+			if (!(bits & 1)) continue;
+			if (n < 6) codes[n] = code;
+			n++;
+		}
+	}
+	for (i=0; i<6; i++) {
+		UEDATX = (n > 6) ? 0x01 : (i < n) ? codes[i] : 0;
+	}
+}
+static inline void keyboard_report_write(const struct keyboard_report_struct *r)
+{
+	keyboard_report_data(r);
+	UEINTX = 0x3A;
+}
+
 // USB Device Interrupt - handle all device-level events
 // the transmit buffer flushing is triggered by the start of frame
 //
 ISR(USB_GEN_vect)
 {
-	uint8_t intbits, i, t;
+	uint8_t intbits, i, j, t;
 	static uint8_t div4=0;
+#if MAKEFILE_DEBUG_CONSOLE
+	static uint8_t debug_frames=0;
+#endif
 
         intbits = UDINT;
         UDINT = 0;
@@ -954,24 +834,89 @@ ISR(USB_GEN_vect)
 		UECFG0X = EP_TYPE_CONTROL;
 		UECFG1X = EP_SIZE(ENDPOINT0_SIZE) | EP_SINGLE_BUFFER;
 		UEIENX = (1<<RXSTPE);
+		ep0_state = EP0_IDLE;
 		usb_configuration = 0;
+		keyboard_protocol = 1;
+		// the host forgets what was pressed: drop what's waiting, and
+		// let the next report (from main(), every scan) start over
+		keyboard_queue_tail = keyboard_queue_head;
+		keyboard_pending_full = 0;
+		keyboard_report_sent.modifier_keys = 0;
+		for (i=0; i<KEYBOARD_KEYS_BYTES; i++) {
+			keyboard_report_sent.keys[i] = 0;
+		}
+		extra_queue_tail = extra_queue_head;
+		for (i=0; i<CONSUMER_KEYS; i++) {
+			last_consumer_keys[i] = 0;
+		}
+		last_system_key = 0;
         }
 	if ((intbits & (1<<SOFI)) && usb_configuration) {
-		if (keyboard_idle_config && (++div4 & 3) == 0) {
-			UENUM = KEYBOARD_ENDPOINT;
-			if (UEINTX & (1<<RWAL)) {
-				keyboard_idle_count++;
-				if (keyboard_idle_count == keyboard_idle_config) {
-					keyboard_idle_count = 0;
-					UEDATX = keyboard_modifier_keys;
-					UEDATX = 0;
-					for (i=0; i<6; i++) {
-						UEDATX = keyboard_keys[i];
-					}
-					UEINTX = 0x3A;
+		UENUM = KEYBOARD_ENDPOINT;
+		if (keyboard_queue_tail != keyboard_queue_head
+				&& (UEINTX & (1<<RWAL))) {
+			i = keyboard_queue_tail;
+			keyboard_report_sent = keyboard_queue[i];
+			keyboard_report_seq_sent = keyboard_report_sent.seq;
+			keyboard_queue_tail = (i + 1) & (KEYBOARD_QUEUE_SIZE - 1);
+			keyboard_report_write(&keyboard_report_sent);
+			keyboard_idle_count = 0;
+		}
+		i = keyboard_queue_head;
+		if (keyboard_pending_full && ((i + 1)
+				& (KEYBOARD_QUEUE_SIZE - 1)) != keyboard_queue_tail) {
+			keyboard_queue[i] = keyboard_pending;
+			keyboard_queue_head = (i + 1) & (KEYBOARD_QUEUE_SIZE - 1);
+			keyboard_pending_full = 0;
+			keyboard_reports_retried++;
+		}
+		// idle: resend the last report once it's been the configured
+		// time since it (or any other) was sent, unless a new one is
+		// waiting (HID 1.11, section 7.2.4)
+		if ((++div4 & 3) == 0 && keyboard_idle_count < 255) {
+			keyboard_idle_count++;
+		}
+		if (keyboard_idle_config
+				&& keyboard_idle_count >= keyboard_idle_config
+				&& keyboard_queue_tail == keyboard_queue_head
+				&& (UEINTX & (1<<RWAL))) {
+			keyboard_report_write(&keyboard_report_sent);
+			keyboard_idle_count = 0;
+		}
+		UENUM = EXTRA_ENDPOINT;
+		if (extra_queue_tail != extra_queue_head
+				&& (UEINTX & (1<<RWAL))) {
+			i = extra_queue_tail;
+			UEDATX = extra_queue[i].report_id;
+			t = (extra_queue[i].report_id == REPORT_ID_CONSUMER)
+				? CONSUMER_KEYS : 1;
+			for (j=0; j<t; j++) {
+				UEDATX = extra_queue[i].data[j] & 0xFF;
+				UEDATX = (extra_queue[i].data[j] >> 8) & 0xFF;
+			}
+			UEINTX = 0x3A;
+			extra_queue_tail = (i + 1) & (EXTRA_QUEUE_SIZE - 1);
+		}
+#if MAKEFILE_DEBUG_CONSOLE
+		UENUM = DEBUG_TX_ENDPOINT;
+		t = (debug_head - debug_tail) & (DEBUG_BUFFER_SIZE - 1);
+		if (t && (UEINTX & (1<<RWAL)) && (t >= DEBUG_TX_SIZE
+				|| debug_flush || ++debug_frames >= DEBUG_FLUSH_FRAMES)) {
+			i = debug_tail;
+			for (t=0; t<DEBUG_TX_SIZE; t++) {
+				if (i == debug_head) {
+					UEDATX = 0;	// hid_listen ignores these
+				} else {
+					UEDATX = debug_buffer[i];
+					i = (i + 1) & (DEBUG_BUFFER_SIZE - 1);
 				}
 			}
+			UEINTX = 0x3A;
+			debug_tail = i;
+			debug_frames = 0;
+			if (i == debug_head) debug_flush = 0;
 		}
+#endif
         // t = rx_timeout_count;
         // if (t) rx_timeout_count = --t;
         // t = tx_timeout_count;
@@ -990,25 +935,64 @@ static inline void usb_send_in(void)
 {
 	UEINTX = ~(1<<TXINI);
 }
-static inline void usb_wait_receive_out(void)
-{
-	while (!(UEINTX & (1<<RXOUTI))) ;
-}
 static inline void usb_ack_out(void)
 {
 	UEINTX = ~(1<<RXOUTI);
 }
 
+// find the descriptor the host asked for: its type is in the high byte of
+// wValue, and its index in the low byte; wIndex is the interface, for HID
+// descriptors (and the language, for strings, which we only have in one
+// of).  returns its length, or 0 if there's no such descriptor.
+static uint8_t usb_descriptor(uint16_t wValue, uint16_t wIndex,
+	const uint8_t **addr)
+{
+	uint8_t index = wValue & 0xFF;
+
+	switch (wValue >> 8) {
+	  case 0x01:	// device
+		if (index) return 0;
+		*addr = device_descriptor;
+		return sizeof(device_descriptor);
+	  case 0x02:	// configuration
+		if (index) return 0;
+		*addr = config1_descriptor;
+		return sizeof(config1_descriptor);
+	  case 0x03:	// string
+		if (index >= NUM_STRINGS) return 0;
+		*addr = (const uint8_t *)pgm_read_word(&string_list[index].addr);
+		return pgm_read_byte(&string_list[index].length);
+	  case 0x21:	// HID
+		if (index || wIndex >= NUM_INTERFACES) return 0;
+		*addr = config1_descriptor
+			+ pgm_read_byte(&hid_desc_list[wIndex].offset);
+		return 9;
+	  case 0x22:	// HID report
+		if (index || wIndex >= NUM_INTERFACES) return 0;
+		*addr = (const uint8_t *)pgm_read_word(&hid_desc_list[wIndex].report);
+		return pgm_read_byte(&hid_desc_list[wIndex].report_length);
+	}
+	return 0;
+}
+
 
 
 // USB Endpoint Interrupt - endpoint 0 is handled here.  The
 // other endpoints are manipulated by the user-callable
 // functions, and the start-of-frame interrupt.
 //
+// Nothing here waits for the host: transfers of more than one packet
+// are continued by later interrupts (see ep0_state), and the replies
+// that wait for TXINI are sent right after a SETUP, when the bank is
+// already free.  Each run reads at most one packet and writes at most
+// one: test/usb-ep0.c makes every request against stubbed registers,
+// and fails if a run waits, or makes more than 44 accesses to UEINTX
+// and UEDATX (a SETUP and a full reply packet).  The most is 41, for
+// a keyboard GET_REPORT.
+//
 ISR(USB_COM_vect)
 {
         uint8_t intbits;
-	const uint8_t *list;
         const uint8_t *cfg;
 	uint8_t i, n, len, en;
 	uint8_t bmRequestType;
@@ -1016,13 +1000,76 @@ ISR(USB_COM_vect)
 	uint16_t wValue;
 	uint16_t wIndex;
 	uint16_t wLength;
-	uint16_t desc_val;
-	const uint8_t *desc_addr;
-	uint8_t	desc_length;
 
         UENUM = 0;
 	intbits = UEINTX;
+	if (!(intbits & (1<<RXSTPI))) {
+		// the next step of a transfer started by an earlier request
+		switch (ep0_state) {
+		  case EP0_DESCRIPTOR:
+		  case EP0_ZEROS:
+			if (intbits & (1<<RXOUTI)) break;	// host ended it
+			if (!(intbits & (1<<TXINI))) return;
+			n = ep0_len < ENDPOINT0_SIZE ? ep0_len : ENDPOINT0_SIZE;
+			if (ep0_state == EP0_ZEROS) {
+				for (i = n; i; i--) {
+					UEDATX = 0;
+				}
+			} else {
+				for (i = n; i; i--) {
+					UEDATX = pgm_read_byte(ep0_addr++);
+				}
+			}
+			ep0_len -= n;
+			usb_send_in();
+			if (n < ENDPOINT0_SIZE) {
+				// that was the last packet
+				ep0_state = EP0_STATUS;
+				UEIENX = (1<<RXSTPE) | (1<<RXOUTE);
+			}
+			return;
+		  case EP0_STATUS:
+			if (!(intbits & (1<<RXOUTI))) return;
+			break;
+		  case EP0_SET_ADDRESS:
+			if (!(intbits & (1<<TXINI))) return;
+			// the address is only used once our status is taken
+			UDADDR = ep0_address | (1<<ADDEN);
+			ep0_state = EP0_IDLE;
+			UEIENX = (1<<RXSTPE);
+			return;
+		  case EP0_SET_REPORT:
+			if (!(intbits & (1<<RXOUTI))) return;
+			keyboard_leds = UEDATX;
+			usb_ack_out();
+			usb_send_in();
+			ep0_state = EP0_IDLE;
+			UEIENX = (1<<RXSTPE);
+			return;
+		  case EP0_DISCARD:
+			if (!(intbits & (1<<RXOUTI))) return;
+			n = ep0_len < ENDPOINT0_SIZE ? ep0_len : ENDPOINT0_SIZE;
+			ep0_len -= n;
+			usb_ack_out();
+			if (ep0_len) return;
+			usb_send_in();
+			ep0_state = EP0_IDLE;
+			UEIENX = (1<<RXSTPE);
+			return;
+		  default:
+			UEIENX = (1<<RXSTPE);
+			return;
+		}
+		// the host's OUT status, ending a transfer to it
+		usb_ack_out();
+		ep0_state = EP0_IDLE;
+		UEIENX = (1<<RXSTPE);
+		return;
+	}
         if (intbits & (1<<RXSTPI)) {
+		// a new request ends any transfer still in progress
+		ep0_state = EP0_IDLE;
+		UEIENX = (1<<RXSTPE);
                 bmRequestType = UEDATX;
                 bRequest = UEDATX;
                 wValue = UEDATX;
@@ -1033,58 +1080,30 @@ ISR(USB_COM_vect)
                 wLength |= (UEDATX << 8);
                 UEINTX = ~((1<<RXSTPI) | (1<<RXOUTI) | (1<<TXINI));
                 if (bRequest == GET_DESCRIPTOR) {
-			list = (const uint8_t *)descriptor_list;
-			for (i=0; ; i++) {
-				if (i >= NUM_DESC_LIST) {
-					UECONX = (1<<STALLRQ)|(1<<EPEN);  //stall
-					return;
-				}
-				desc_val = pgm_read_word(list);
-				if (desc_val != wValue) {
-					list += sizeof(struct descriptor_list_struct);
-					continue;
-				}
-				list += 2;
-				desc_val = pgm_read_word(list);
-				if (desc_val != wIndex) {
-					list += sizeof(struct descriptor_list_struct)-2;
-					continue;
-				}
-				list += 2;
-				desc_addr = (const uint8_t *)pgm_read_word(list);
-				list += 2;
-				desc_length = pgm_read_byte(list);
-				break;
+			n = usb_descriptor(wValue, wIndex, &ep0_addr);
+			if (!n) {
+				UECONX = (1<<STALLRQ)|(1<<EPEN);  //stall
+				return;
 			}
 			len = (wLength < 256) ? wLength : 255;
-			if (len > desc_length) len = desc_length;
-			do {
-				// wait for host ready for IN packet
-				do {
-					i = UEINTX;
-				} while (!(i & ((1<<TXINI)|(1<<RXOUTI))));
-				if (i & (1<<RXOUTI)) return;	// abort
-				// send IN packet
-				n = len < ENDPOINT0_SIZE ? len : ENDPOINT0_SIZE;
-				for (i = n; i; i--) {
-					UEDATX = pgm_read_byte(desc_addr++);
-				}
-				len -= n;
-				usb_send_in();
-			} while (len || n == ENDPOINT0_SIZE);
+			ep0_len = (len > n) ? n : len;
+			// sent a packet at a time, as the host takes each
+			ep0_state = EP0_DESCRIPTOR;
+			UEIENX = (1<<RXSTPE) | (1<<TXINE) | (1<<RXOUTE);
 			return;
                 }
 		if (bRequest == SET_ADDRESS) {
 			usb_send_in();
-			usb_wait_in_ready();
-			UDADDR = wValue | (1<<ADDEN);
+			ep0_address = wValue;
+			ep0_state = EP0_SET_ADDRESS;
+			UEIENX = (1<<RXSTPE) | (1<<TXINE);
 			return;
 		}
 		if (bRequest == SET_CONFIGURATION && bmRequestType == 0) {
 			usb_configuration = wValue;
 			usb_send_in();
 			cfg = endpoint_config_table;
-			for (i=1; i<5; i++) {
+			for (i=1; i<=MAX_ENDPOINT; i++) {
 				UENUM = i;
 				en = pgm_read_byte(cfg++);
 				UECONX = en;
@@ -1093,7 +1112,7 @@ ISR(USB_COM_vect)
 					UECFG1X = pgm_read_byte(cfg++);
 				}
 			}
-        		UERST = 0x1E;
+        		UERST = (1 << (MAX_ENDPOINT + 1)) - 2;
         		UERST = 0;
 			return;
 		}
@@ -1141,11 +1160,7 @@ ISR(USB_COM_vect)
 			if (bmRequestType == 0xA1) {
 				if (bRequest == HID_GET_REPORT) {
 					usb_wait_in_ready();
-					UEDATX = keyboard_modifier_keys;
-					UEDATX = 0;
-					for (i=0; i<6; i++) {
-						UEDATX = keyboard_keys[i];
-					}
+					keyboard_report_data(&keyboard_report_sent);
 					usb_send_in();
 					return;
 				}
@@ -1164,15 +1179,16 @@ ISR(USB_COM_vect)
 			}
 			if (bmRequestType == 0x21) {
 				if (bRequest == HID_SET_REPORT) {
-					usb_wait_receive_out();
-					keyboard_leds = UEDATX;
-					usb_ack_out();
-					usb_send_in();
+					// read when it comes
+					ep0_state = EP0_SET_REPORT;
+					UEIENX = (1<<RXSTPE) | (1<<RXOUTE);
 					return;
 				}
 				if (bRequest == HID_SET_IDLE) {
+					// the new duration counts from the last
+					// report sent, so if that was longer ago,
+					// the report is resent at the next frame
 					keyboard_idle_config = (wValue >> 8);
-					keyboard_idle_count = 0;
 					usb_send_in();
 					return;
 				}
@@ -1183,85 +1199,96 @@ ISR(USB_COM_vect)
 				}
 			}
 		}
-		// if (wIndex == RAWHID_INTERFACE) {
-		// 	if (bmRequestType == 0xA1 && bRequest == HID_GET_REPORT) {
-		// 		len = RAWHID_TX_SIZE;
-		// 		do {
-		// 			// wait for host ready for IN packet
-		// 			do {
-		// 				i = UEINTX;
-		// 			} while (!(i & ((1<<TXINI)|(1<<RXOUTI))));
-		// 			if (i & (1<<RXOUTI)) return;	// abort
-		// 			// send IN packet
-		// 			n = len < ENDPOINT0_SIZE ? len : ENDPOINT0_SIZE;
-		// 			for (i = n; i; i--) {
-		// 				// just send zeros
-		// 				UEDATX = 0;
-		// 			}
-		// 			len -= n;
-		// 			usb_send_in();
-		// 		} while (len || n == ENDPOINT0_SIZE);
-		// 		return;
-		// 	}
-		// 	if (bmRequestType == 0x21 && bRequest == HID_SET_REPORT) {
-		// 		len = RAWHID_RX_SIZE;
-		// 		do {
-		// 			n = len < ENDPOINT0_SIZE ? len : ENDPOINT0_SIZE;
-		// 			usb_wait_receive_out();
-		// 			// ignore incoming bytes
-		// 			usb_ack_out();
-		// 			len -= n;
-		// 		} while (len);
-		// 		usb_wait_in_ready();
-		// 		usb_send_in();
-		// 		return;
-		// 	}
-		// }
+		if (wIndex == EXTRA_INTERFACE) {
+			// extra reports are only sent when they change, which
+			// is an idle rate of 0 (indefinite); other rates stall
+			if (bmRequestType == 0xA1 && bRequest == HID_GET_IDLE) {
+				usb_wait_in_ready();
+				UEDATX = 0;
+				usb_send_in();
+				return;
+			}
+			if (bmRequestType == 0x21 && bRequest == HID_SET_IDLE
+					&& (wValue >> 8) == 0) {
+				usb_send_in();
+				return;
+			}
+		}
+		if (wIndex == RAWHID_INTERFACE) {
+			// reports go through the endpoints; these are only
+			// here because HID requires them.  GET_REPORT sends
+			// zeros, and SET_REPORT's data is read and ignored.
+			if (bmRequestType == 0xA1 && bRequest == HID_GET_REPORT) {
+				ep0_len = (wLength < RAWHID_TX_SIZE)
+					? wLength : RAWHID_TX_SIZE;
+				ep0_state = EP0_ZEROS;
+				UEIENX = (1<<RXSTPE) | (1<<TXINE) | (1<<RXOUTE);
+				return;
+			}
+			if (bmRequestType == 0x21 && bRequest == HID_SET_REPORT) {
+				ep0_len = (wLength < RAWHID_RX_SIZE)
+					? wLength : RAWHID_RX_SIZE;
+				if (!ep0_len) {
+					usb_send_in();
+					return;
+				}
+				ep0_state = EP0_DISCARD;
+				UEIENX = (1<<RXSTPE) | (1<<RXOUTE);
+				return;
+			}
+		}
 	}
 	UECONX = (1<<STALLRQ) | (1<<EPEN);	// stall
 }
 
-int8_t usb_extra_send(uint8_t report_id, uint16_t data)
+// queue an extra report (count usages from data), to be sent at the next
+// start of frame that the endpoint has a free bank.  This never waits: if
+// the queue is full, -1 is returned and the report is not queued.
+static int8_t usb_extra_send(uint8_t report_id, const uint16_t *data,
+	uint8_t count)
 {
-	uint8_t intr_state, timeout;
+	uint8_t intr_state, head, i;
 
-	if (!usb_configured()) return -1;
+	if (!usb_configuration) return -1;
 	intr_state = SREG;
 	cli();
-	UENUM = EXTRA_ENDPOINT;
-	timeout = UDFNUML + 50;
-	while (1) {
-		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
+	head = extra_queue_head;
+	if (((head + 1) & (EXTRA_QUEUE_SIZE - 1)) == extra_queue_tail) {
 		SREG = intr_state;
-		// has the USB gone offline?
-		if (!usb_configured()) return -1;
-		// have we waited too long?
-		if (UDFNUML == timeout) return -1;
-		// get ready to try checking again
-		intr_state = SREG;
-		cli();
-		UENUM = EXTRA_ENDPOINT;
+		return -1;
 	}
-
-	UEDATX = report_id;
-        UEDATX = data&0xFF;
-        UEDATX = (data>>8)&0xFF;
-
-	UEINTX = 0x3A;
+	extra_queue[head].report_id = report_id;
+	for (i=0; i<count; i++) {
+		extra_queue[head].data[i] = data[i];
+	}
+	extra_queue_head = (head + 1) & (EXTRA_QUEUE_SIZE - 1);
 	SREG = intr_state;
 	return 0;
 }
 
-int8_t usb_extra_consumer_send()
+// queue a consumer report, if consumer_keys has changed since the last one.
+// held keys are not resent: the host repeats them itself.
+int8_t usb_extra_consumer_send(void)
 {
-	int result = 0;
-	// don't resend the same key repeatedly if held, only send it once.
-	if (consumer_key != last_consumer_key) {
-		result = usb_extra_send(REPORT_ID_CONSUMER, consumer_key);
-		if (result == 0) {
-			last_consumer_key = consumer_key;
-		}
+	uint8_t i;
+
+	for (i=0; i<CONSUMER_KEYS; i++) {
+		if (consumer_keys[i] != last_consumer_keys[i]) break;
 	}
-	return result;
+	if (i == CONSUMER_KEYS) return 0;
+	if (usb_extra_send(REPORT_ID_CONSUMER, consumer_keys, CONSUMER_KEYS))
+		return -1;
+	for (i=0; i<CONSUMER_KEYS; i++) {
+		last_consumer_keys[i] = consumer_keys[i];
+	}
+	return 0;
+}
+
+// queue a system control report, if system_key has changed since the last
+int8_t usb_extra_system_send(void)
+{
+	if (system_key == last_system_key) return 0;
+	if (usb_extra_send(REPORT_ID_SYSTEM, &system_key, 1)) return -1;
+	last_system_key = system_key;
+	return 0;
 }
@@ -8,22 +8,47 @@ uint8_t usb_configured(void);		// is the USB port configured
 
 int8_t usb_keyboard_press(uint8_t key, uint8_t modifier);
 int8_t usb_keyboard_send(void);
+uint8_t usb_keyboard_queued(void);	// reports waiting to be sent
+#define KEYBOARD_QUEUE_SIZE	8	// must be a power of 2 (holds one less)
 extern uint8_t keyboard_modifier_keys;
-extern uint8_t keyboard_keys[6];
-extern volatile uint8_t keyboard_leds;
-
-extern uint16_t consumer_key;
-
-// int8_t usb_rawhid_recv(uint8_t *buffer, uint8_t timeout);  // receive a packet, with timeout
-// int8_t usb_rawhid_send(const uint8_t *buffer, uint8_t timeout); // send a packet, with timeout
 
-// This file does not include the HID debug functions, so these empty
-// macros replace them with nothing, so users can compile code that
-// has calls to these functions.
+// which keys are pressed: a bitmap of usages 0x00 to 0xDF (the modifiers,
+// 0xE0 to 0xE7, are in keyboard_modifier_keys)
+#define KEYBOARD_KEYS_BYTES	28
+extern uint8_t keyboard_keys[KEYBOARD_KEYS_BYTES];
+#define keyboard_key_set(k)	(keyboard_keys[(k) >> 3] |= (1 << ((k) & 7)))
+#define keyboard_key_clear(k)	(keyboard_keys[(k) >> 3] &= ~(1 << ((k) & 7)))
+#define keyboard_key_is_set(k)	(keyboard_keys[(k) >> 3] & (1 << ((k) & 7)))
+extern volatile uint8_t keyboard_leds;
+extern uint16_t keyboard_reports_suppressed;	// duplicates not queued
+extern uint8_t keyboard_report_seq;		// newest report accepted
+extern volatile uint8_t keyboard_report_seq_sent;	// last report sent
+extern uint16_t keyboard_reports_dropped;	// not accepted (queue full)
+extern volatile uint16_t keyboard_reports_retried;	// queued late
+
+#define CONSUMER_KEYS		4	// consumer keys held at once
+extern uint16_t consumer_keys[CONSUMER_KEYS];	// 0 for none
+extern uint16_t system_key;			// 0 for none
+
+int8_t usb_rawhid_recv(uint8_t *buffer);	// receive a packet, if one's waiting
+int8_t usb_rawhid_send(const uint8_t *buffer);	// send a packet, if there's room
+#define RAWHID_TX_SIZE		64	// transmit packet size
+#define RAWHID_RX_SIZE		64	// receive packet size
+
+#if MAKEFILE_DEBUG_CONSOLE
+int8_t usb_debug_putchar(uint8_t c);	// queue a byte; never waits
+void usb_debug_flush_output(void);	// send what's queued at the next frame
+extern uint16_t usb_debug_dropped;	// bytes not queued (buffer full)
+#else
+// The HID debug interface is compiled out (see DEBUG_CONSOLE in
+// "makefile-options"), so these empty macros replace its functions
+// with nothing, so users can compile code that has calls to them.
 #define usb_debug_putchar(c)
 #define usb_debug_flush_output()
+#endif
 
-extern int8_t usb_extra_consumer_send();
+int8_t usb_extra_consumer_send(void);	// queue consumer_keys, if changed
+int8_t usb_extra_system_send(void);	// queue system_key, if changed
 
 /* Consumer Page(0x0C)
  * following are supported by Windows: http://msdn.microsoft.com/en-us/windows/hardware/gg463372.aspx
@@ -82,7 +107,11 @@ extern int8_t usb_extra_consumer_send();
 			((s) == 16 ? 0x10 :	\
 			             0x00)))
 
+#if MAKEFILE_DEBUG_CONSOLE
+#define MAX_ENDPOINT		5
+#else
 #define MAX_ENDPOINT		4
+#endif
 
 #define LSB(n) (n & 255)
 #define MSB(n) ((n >> 8) & 255)